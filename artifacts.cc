@@ -0,0 +1,95 @@
+/**
+ * @file artifacts.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Stamp the files that monster-trunk and its tools generate with the crawl
+ * version and a hash of what they were made from, and tell whether a
+ * generated file is stale, so that only stale files need to be remade.
+ *
+ * The vault index keeps its stamp in its header. Text files start with a
+ * stamp line: ARTIFACT_STAMP_PREFIX, then space-separated key=value pairs:
+ *
+ *   crawl=<version>   The crawl version it was made with.
+ *   des=<hash>        The hash of the .des files it was made from.
+ *   data=<hash>       The hash of the vault monster data it was made from.
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "artifacts.h"
+#include "stringutil.h"
+#include "vault_index.h"
+#include "vault_monster_data.h"
+#include "vault_monster_format.h"
+#include "version.h"
+
+/**
+ * Return the stamp for a text file made now, without ARTIFACT_STAMP_PREFIX.
+ *
+ * @param source What the file is made from.
+**/
+std::string artifact_stamp (artifact_source source)
+{
+    if (source == ARTIFACT_FROM_DES)
+    {
+        return make_stringf("crawl=%s des=%08x", Version::Long,
+                            vault_monster_des_hash());
+    }
+    return make_stringf("crawl=%s data=%08x", Version::Long,
+                        vault_monster_data_hash());
+}
+
+/**
+ * Return why a generated file is stale, or an empty string if it is up to
+ * date with this monster-trunk and the vault data linked into it.
+ *
+ * @param filename The file: the vault index, or a stamped text file.
+**/
+std::string artifact_staleness (const std::string &filename)
+{
+    FILE *in = fopen(filename.c_str(), "rb");
+    if (!in)
+        return ("it doesn't exist");
+
+    char buf[4096];
+    const bool read = fgets(buf, sizeof buf, in);
+    fclose(in);
+
+    if (read && !memcmp(buf, VAULT_INDEX_MAGIC, sizeof(VAULT_INDEX_MAGIC)))
+        return vault_index_staleness(filename);
+
+    std::string stamp = read ? buf : "";
+    if (!starts_with(stamp, ARTIFACT_STAMP_PREFIX))
+        return ("it has no stamp");
+    stamp = trimmed_string(stamp.substr(strlen(ARTIFACT_STAMP_PREFIX)));
+
+    const std::vector<std::string> fields = split_string(" ", stamp);
+    for (unsigned int i = 0; i < fields.size(); ++i)
+    {
+        const std::string::size_type eq = fields[i].find('=');
+        if (eq == std::string::npos)
+            continue;
+        const std::string key = fields[i].substr(0, eq);
+        const std::string value = fields[i].substr(eq + 1);
+
+        if (key == "crawl" && value != Version::Long)
+        {
+            return make_stringf("it was made with crawl %s, not %s",
+                                value.c_str(), Version::Long);
+        }
+        if (key == "des" && strtoul(value.c_str(), NULL, 16)
+                            != vault_monster_des_hash())
+        {
+            return ("the .des files have changed since it was made");
+        }
+        if (key == "data" && strtoul(value.c_str(), NULL, 16)
+                             != vault_monster_data_hash())
+        {
+            return ("the vault monster data has changed since it was made");
+        }
+    }
+
+    return ("");
+}
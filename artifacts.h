@@ -0,0 +1,23 @@
+/**
+ * artifacts.h
+**/
+
+#ifndef __ARTIFACTS_H__
+#define __ARTIFACTS_H__
+
+#include "AppHdr.h"
+
+// The first line of a generated text file, followed by its stamp.
+#define ARTIFACT_STAMP_PREFIX "# monster-trunk: "
+
+// What a generated file was made from.
+enum artifact_source
+{
+    ARTIFACT_FROM_DES,          // The .des files.
+    ARTIFACT_FROM_VAULT_DATA,   // The vault monster data.
+};
+
+std::string artifact_stamp (artifact_source source);
+std::string artifact_staleness (const std::string &filename);
+
+#endif
@@ -0,0 +1,1301 @@
+/**
+ * @file des_scanner.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Scan every .des file in the crawl tree for named vault monster
+ * specifications and pack them into vault_monster_data.bin (see
+ * vault_monster_format.h), which is linked into monster-trunk.
+ *
+ * This replaces the regular expression pass that parse_des.py used to do,
+ * and must extract exactly the same set of specifications: MONS and KMONS
+ * lines, Lua mons()/kmons() calls and the sprint monster tables. Each file is
+ * memory-mapped and cleaned up in a single pass before being scanned.
+ *
+ * The specifications found in each file are cached, keyed on its content
+ * hash, so that only changed files are re-scanned; the output is only
+ * rewritten if it would change.
+ *
+ * Specifications listed in the prune file, as written by
+ * monster-trunk --validate-vault-specs, are left out. Specifications that
+ * vault Lua emits at runtime, as captured by monster-trunk
+ * --capture-vault-lua, are merged in when no .des file spells them out. For
+ * every specification, the .des files, maps and lines it was found at are
+ * recorded.
+ *
+ * The output is stamped with the crawl version and a hash of the .des files,
+ * so that monster-trunk can tell when it, or anything made from it, is stale.
+ *
+**/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "vault_monster_format.h"
+
+static const char *USAGE =
+"usage: des-scanner [des_folder] [output_file] [options]\n"
+"\n"
+"DESCRIPTION\n"
+"    Attempts to parse all of the .des files contained within des_folder,\n"
+"    pack the monsters found into a table, and store it in output_file.\n"
+"\n"
+"    The monsters found in each .des file are cached in cache_file, keyed on\n"
+"    the file's content hash, so only changed files are re-scanned. The\n"
+"    output_file is only rewritten if its contents would change.\n"
+"\n"
+"OPTIONS\n"
+"    -v  --verbose   Print a list of generated files.\n"
+"    -f  --force     Ignore the cache and re-scan every file.\n"
+"    -p  --prune prune_file\n"
+"                    Leave out the monsters listed in prune_file.\n"
+"    -l  --lua lua_file\n"
+"                    Add the monsters that vault Lua emits, listed in\n"
+"                    lua_file.\n"
+"    -c  --crawl-version version\n"
+"                    Stamp output_file with the crawl version that the\n"
+"                    .des files belong to.\n"
+"    -h  --help      Print this message.\n"
+"\n"
+"DEFAULTS\n"
+"    des_folder      %s\n"
+"    output_file     %s\n"
+"    cache_file      %s\n"
+"    prune_file      %s, if it exists\n"
+"    lua_file        %s, if it exists\n";
+
+// Defaults:
+static const char *DEFAULT_DES_FOLDER = "crawl-ref/crawl-ref/source/dat/des";
+static const char *DEFAULT_OUTPUT = "vault_monster_data.bin";
+static const char *DEFAULT_CACHE = "vault_monster_data.cache";
+static const char *DEFAULT_PRUNE = "vault_monster_invalid.txt";
+static const char *DEFAULT_LUA = "vault_monster_lua.txt";
+
+// These des files will be ignored.
+static const char *IGNORE_DES_FILES[] = { "test.des" };
+
+// Any des file in these subfolders will be ignored.
+static const char *IGNORE_DES_SUBFOLDERS[] = { "builder", "zotdef", "tutorial" };
+
+// Bump this whenever the extraction rules below change, so that stale cache
+// entries are discarded rather than reused.
+static const char *CACHE_HEADER = "# des-scanner cache v4";
+
+typedef std::vector<std::string> spec_list;
+
+// A specification, and the map (NAME:) and line it was found at.
+struct des_spec
+{
+    std::string map;
+    int line;
+    std::string spec;
+};
+
+typedef std::vector<des_spec> des_spec_list;
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v'
+           || c == '\f';
+}
+
+static inline bool is_word(char c)
+{
+    return c >= 'a' && c <= 'z' || c >= 'A' && c <= 'Z'
+           || c >= '0' && c <= '9' || c == '_';
+}
+
+static inline bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static bool starts_with_at(const std::string &s, std::size_t pos,
+                           const char *prefix)
+{
+    return s.compare(pos, strlen(prefix), prefix) == 0;
+}
+
+static std::string strip(const std::string &s)
+{
+    std::size_t first = 0, last = s.size();
+    while (first < last && is_space(s[first]))
+        ++first;
+    while (last > first && is_space(s[last - 1]))
+        --last;
+    return s.substr(first, last - first);
+}
+
+static std::string strip_chars(const std::string &s, char c)
+{
+    std::size_t first = 0, last = s.size();
+    while (first < last && s[first] == c)
+        ++first;
+    while (last > first && s[last - 1] == c)
+        --last;
+    return s.substr(first, last - first);
+}
+
+static std::string replace_all(const std::string &s, const std::string &from,
+                               const std::string &to)
+{
+    std::string result;
+    std::size_t pos = 0, found;
+    while ((found = s.find(from, pos)) != std::string::npos)
+    {
+        result.append(s, pos, found - pos);
+        result += to;
+        pos = found + from.size();
+    }
+    result.append(s, pos, std::string::npos);
+    return result;
+}
+
+/**
+ * Replace every run of whitespace with the last character of that run.
+ */
+static std::string collapse_whitespace(const std::string &s)
+{
+    std::string result;
+    result.reserve(s.size());
+    for (std::size_t i = 0; i < s.size(); ++i)
+    {
+        if (is_space(s[i]) && i + 1 < s.size() && is_space(s[i + 1]))
+            continue;
+        result += s[i];
+    }
+    return result;
+}
+
+static void split(const std::string &s, char delim, spec_list &parts)
+{
+    std::size_t pos = 0, found;
+    while ((found = s.find(delim, pos)) != std::string::npos)
+    {
+        parts.push_back(s.substr(pos, found - pos));
+        pos = found + 1;
+    }
+    parts.push_back(s.substr(pos));
+}
+
+/**
+ * Find every "quoted phrase" in a string, and return the phrases without
+ * their quotes.
+ */
+static spec_list find_quoted(const std::string &s)
+{
+    spec_list quoted;
+    std::size_t pos = 0, open, close;
+    while ((open = s.find('"', pos)) != std::string::npos
+           && (close = s.find('"', open + 1)) != std::string::npos)
+    {
+        quoted.push_back(s.substr(open + 1, close - open - 1));
+        pos = close + 1;
+    }
+    return quoted;
+}
+
+/**
+ * Remove "MONS" or "KMONS" specifiers and related information (glyphs, etc).
+ *
+ * @param line The line to clean up.
+ * @return The cleaned-up line.
+**/
+static std::string cleanup_mons_line(std::string line)
+{
+    line = strip(line);
+
+    if (line.compare(0, 6, "KMONS:") == 0)
+        line = strip(line.substr(line.rfind('=') + 1));
+
+    line = replace_all(line, "MONS:", "");
+    line = collapse_whitespace(line);
+
+    return strip(line);
+}
+
+/**
+ * Add the monsters contained in a MONS line to a list, cleaning up each
+ * monster.
+ *
+ * @param line     The line to parse.
+ * @param monsters The list to add the monsters to.
+**/
+static void parse_mons_line(const std::string &line, spec_list &monsters)
+{
+    spec_list slashed, parts;
+    split(cleanup_mons_line(line), '/', slashed);
+    for (std::size_t i = 0; i < slashed.size(); ++i)
+        split(slashed[i], ',', parts);
+
+    for (std::size_t i = 0; i < parts.size(); ++i)
+    {
+        std::string mons = parts[i];
+        const std::size_t semi = mons.find("; ");
+        if (semi != std::string::npos)
+            mons.erase(semi);
+        monsters.push_back(cleanup_mons_line(mons));
+    }
+}
+
+/**
+ * Strip out Lua-specific non-specification data from a mons() or kmons()
+ * call, and add the contained monsters to a list.
+ *
+ * @param line     The call to parse.
+ * @param monsters The list to add the monsters to.
+**/
+static void parse_lua_line(const std::string &line, spec_list &monsters)
+{
+    std::string args = line.substr(line.find('(') + 1);
+    while (!args.empty() && args[args.size() - 1] == ')')
+        args.erase(args.size() - 1);
+    const spec_list quoted = find_quoted(args);
+
+    for (std::size_t i = 0; i < quoted.size(); ++i)
+    {
+        if (strip(quoted[i]) == "nothing")
+            continue;
+
+        parse_mons_line(strip_chars(strip_chars(quoted[i], '\''), '"'),
+                        monsters);
+    }
+}
+
+/**
+ * Drop Lua comments and blank lines, and join lines continued by a trailing
+ * ';' or '\'.
+ *
+ * @param data         The raw contents of a .des file.
+ * @param size         The length of data.
+ * @param line_starts  Where each kept line starts in the cleaned-up contents.
+ * @param line_numbers The line number, in data, of each kept line.
+ * @return The cleaned-up contents.
+**/
+static std::string cleanup_des_data(const char *data, std::size_t size,
+                                    std::vector<std::size_t> &line_starts,
+                                    std::vector<int> &line_numbers)
+{
+    std::string clean;
+    clean.reserve(size);
+
+    const char *end = data + size;
+    int line_number = 0;
+    for (const char *line = data; line < end; )
+    {
+        ++line_number;
+        const char *eol = static_cast<const char *>(
+            memchr(line, '\n', end - line));
+        if (!eol)
+            eol = end;
+
+        const char *first = line, *last = eol;
+        for (const char *c = line; c + 1 < eol; ++c)
+        {
+            if (c[0] == '-' && c[1] == '-')
+            {
+                last = c;
+                break;
+            }
+        }
+        while (first < last && is_space(*first))
+            ++first;
+        while (last > first && is_space(last[-1]))
+            --last;
+
+        if (first < last)
+        {
+            if (!clean.empty())
+            {
+                // Every kept line ends in something other than whitespace,
+                // so this is where the continuations are joined.
+                const char prev = clean[clean.size() - 1];
+                if (prev == '\\')
+                    clean.erase(clean.size() - 1);
+                else if (prev != ';')
+                    clean += '\n';
+            }
+            line_starts.push_back(clean.size());
+            line_numbers.push_back(line_number);
+            clean.append(first, last);
+        }
+
+        line = eol + 1;
+    }
+
+    return clean;
+}
+
+/**
+ * Find the map that each position in the cleaned-up contents of a .des file
+ * belongs to, and the line of the original file that it came from.
+**/
+class map_names
+{
+public:
+    map_names(const std::string &d, const std::vector<std::size_t> &ls,
+              const std::vector<int> &ln)
+        : line_starts(ls), line_numbers(ln)
+    {
+        for (std::size_t pos = 0; pos < d.size(); )
+        {
+            if (starts_with_at(d, pos, "NAME:"))
+            {
+                std::size_t first = pos + 5, last;
+                while (first < d.size() && is_space(d[first]) && d[first] != '\n')
+                    ++first;
+                for (last = first; last < d.size() && !is_space(d[last]); ++last)
+                    ;
+                starts.push_back(pos);
+                names.push_back(d.substr(first, last - first));
+            }
+
+            pos = d.find('\n', pos);
+            if (pos != std::string::npos)
+                ++pos;
+        }
+    }
+
+    /**
+     * Add monsters to a list, recording the map and line they were found at.
+     *
+     * @param pos      Where the monsters were found.
+     * @param monsters The monsters.
+     * @param found    The list to add them to.
+    **/
+    void add(std::size_t pos, const spec_list &monsters,
+             des_spec_list &found) const
+    {
+        const std::size_t i =
+            std::upper_bound(starts.begin(), starts.end(), pos) - starts.begin();
+        const std::size_t l =
+            std::upper_bound(line_starts.begin(), line_starts.end(), pos)
+            - line_starts.begin();
+        des_spec mons;
+        mons.map = i ? names[i - 1] : "";
+        mons.line = l ? line_numbers[l - 1] : 0;
+        for (std::size_t j = 0; j < monsters.size(); ++j)
+        {
+            mons.spec = monsters[j];
+            found.push_back(mons);
+        }
+    }
+
+private:
+    std::vector<std::size_t> starts;
+    spec_list names;
+    const std::vector<std::size_t> &line_starts;
+    const std::vector<int> &line_numbers;
+};
+
+/**
+ * Add every monster defined in the contents of a single .des file to a list.
+ *
+ * @param data  The raw contents of the file.
+ * @param size  The length of data.
+ * @param specs The list to add the monsters to.
+**/
+static void parse_des_data(const char *data, std::size_t size,
+                           des_spec_list &specs)
+{
+    std::vector<std::size_t> line_starts;
+    std::vector<int> line_numbers;
+    const std::string d =
+        cleanup_des_data(data, size, line_starts, line_numbers);
+    const std::size_t n = d.size();
+    const map_names maps(d, line_starts, line_numbers);
+    spec_list monsters;
+
+    // MONS: and KMONS: lines. These run to the end of the line, but a line
+    // with nothing after the specifier takes the next one instead.
+    for (std::size_t pos = 0, found; (found = d.find("MONS:", pos)) != std::string::npos; )
+    {
+        const std::size_t start =
+            found > pos && d[found - 1] == 'K' ? found - 1 : found;
+        std::size_t p = found + 5;
+        while (p < n && is_space(d[p]))
+            ++p;
+
+        std::size_t nl = d.find('\n', p);
+        if (nl == std::string::npos)
+        {
+            nl = d.rfind('\n', p - 1);
+            if (nl == std::string::npos || nl < found + 5)
+                break;
+        }
+
+        monsters.clear();
+        parse_mons_line(d.substr(start, nl + 1 - start), monsters);
+        maps.add(start, monsters, specs);
+        pos = nl + 1;
+    }
+
+    // Lua mons() and kmons() calls.
+    for (std::size_t pos = 0, found; (found = d.find("mons(", pos)) != std::string::npos; )
+    {
+        const std::size_t start =
+            found > pos && d[found - 1] == 'k' ? found - 1 : found;
+        const std::size_t close = d.find(')', found + 5);
+        if (close == std::string::npos)
+            break;
+
+        monsters.clear();
+        parse_lua_line(d.substr(start, close + 1 - start), monsters);
+        maps.add(start, monsters, specs);
+        pos = close + 1;
+    }
+
+    // Lua data definitions of arenasprint and meatsprint monster and boss
+    // sets: "bs[N] =", "mon_set =" or "local name =", optionally followed by
+    // " {", and then a list of quoted monster definitions.
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        std::size_t p = i;
+        if (starts_with_at(d, p, "bs["))
+        {
+            p += 3;
+            const std::size_t digits = p;
+            while (p < n && is_digit(d[p]))
+                ++p;
+            if (p == digits || p >= n || d[p] != ']')
+                continue;
+            ++p;
+        }
+        else if (starts_with_at(d, p, "mon_set"))
+            p += 7;
+        else if (starts_with_at(d, p, "local "))
+        {
+            p += 6;
+            const std::size_t word = p;
+            while (p < n && is_word(d[p]))
+                ++p;
+            if (p == word)
+                continue;
+        }
+        else
+            continue;
+
+        if (!starts_with_at(d, p, " ="))
+            continue;
+        p += 2;
+        if (starts_with_at(d, p, " {"))
+            p += 2;
+        while (p < n && is_space(d[p]))
+            ++p;
+        if (p >= n || d[p] != '"')
+            continue;
+
+        std::size_t brace = d.find('}', p + 1);
+        if (brace == std::string::npos)
+            brace = n;
+        const std::size_t last = d.rfind('"', brace - 1);
+        if (last == p)
+            continue;
+
+        const spec_list quoted = find_quoted(d.substr(p, last + 1 - p));
+        monsters.clear();
+        for (std::size_t j = 0; j < quoted.size(); ++j)
+            parse_mons_line(quoted[j], monsters);
+        maps.add(i, monsters, specs);
+
+        i = last;
+    }
+}
+
+/**
+ * Return a copy of a list that does not contain any unnamed monsters. These
+ * are indistinguishable from other monsters.
+**/
+static des_spec_list cull_unnamed_monsters(const des_spec_list &monsters)
+{
+    des_spec_list named;
+    for (std::size_t i = 0; i < monsters.size(); ++i)
+        if (monsters[i].spec.find("name") != std::string::npos)
+            named.push_back(monsters[i]);
+    return named;
+}
+
+static bool is_ignored(const char *name, const char **list, std::size_t size)
+{
+    for (std::size_t i = 0; i < size; ++i)
+        if (!strcmp(name, list[i]))
+            return true;
+    return false;
+}
+
+#define IGNORED(name, list) is_ignored(name, list, sizeof(list) / sizeof(*list))
+
+static bool ends_with(const std::string &s, const std::string &suffix)
+{
+    return s.size() >= suffix.size()
+           && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/**
+ * Add the path of every .des file in a folder, relative to the top-level des
+ * folder, to a list. Files in IGNORE_DES_FILES are ignored; likewise, files
+ * directly inside folders named in IGNORE_DES_SUBFOLDERS are skipped.
+ * Symbolic links to folders are not followed.
+ *
+ * @param folder   The path of the folder on disk.
+ * @param relative Its path relative to the top-level des folder.
+ * @param files    The list to add the files to.
+**/
+static void find_des_files(const std::string &folder,
+                           const std::string &relative,
+                           std::vector<std::string> &files)
+{
+    DIR *dir = opendir(folder.c_str());
+    if (!dir)
+        return;
+
+    const std::string this_dir = folder.substr(folder.rfind('/') + 1);
+    const bool skip_files = IGNORED(this_dir.c_str(), IGNORE_DES_SUBFOLDERS);
+
+    while (dirent *entry = readdir(dir))
+    {
+        const std::string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+
+        const std::string path = folder + "/" + name;
+        const std::string rel = relative.empty() ? name : relative + "/" + name;
+
+        struct stat st;
+        if (lstat(path.c_str(), &st))
+            continue;
+
+        if (S_ISDIR(st.st_mode))
+        {
+            find_des_files(path, rel, files);
+            continue;
+        }
+
+        if (S_ISLNK(st.st_mode) && !stat(path.c_str(), &st)
+            && S_ISDIR(st.st_mode))
+        {
+            continue;
+        }
+
+        if (skip_files || IGNORED(name.c_str(), IGNORE_DES_FILES)
+            || !ends_with(name, ".des"))
+        {
+            continue;
+        }
+
+        files.push_back(rel);
+    }
+
+    closedir(dir);
+}
+
+/**
+ * A read-only memory mapping of a whole file.
+**/
+class mapped_file
+{
+public:
+    mapped_file(const std::string &path) : data(0), size(0)
+    {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+
+        struct stat st;
+        if (!fstat(fd, &st) && st.st_size > 0)
+        {
+            void *map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED)
+            {
+                data = static_cast<const char *>(map);
+                size = st.st_size;
+            }
+        }
+        close(fd);
+    }
+
+    ~mapped_file()
+    {
+        if (data)
+            munmap(const_cast<char *>(data), size);
+    }
+
+    const char *data;
+    std::size_t size;
+
+private:
+    mapped_file(const mapped_file &);
+    mapped_file &operator=(const mapped_file &);
+};
+
+struct cache_entry
+{
+    unsigned long hash;
+    long long size;
+    long long mtime;
+    des_spec_list monsters;
+};
+
+typedef std::map<std::string, cache_entry> des_cache;
+
+static std::string escape_cache_line(const std::string &line)
+{
+    return replace_all(replace_all(line, "\\", "\\\\"), "\n", "\\n");
+}
+
+static std::string unescape_cache_line(const std::string &line)
+{
+    std::string result;
+    for (std::size_t i = 0; i < line.size(); ++i)
+    {
+        if (line[i] == '\\' && i + 1 < line.size())
+        {
+            ++i;
+            result += line[i] == 'n' ? '\n' : line[i];
+        }
+        else
+            result += line[i];
+    }
+    return result;
+}
+
+static bool read_file(const std::string &path, std::string &data)
+{
+    mapped_file file(path);
+    if (!file.data)
+    {
+        struct stat st;
+        return !stat(path.c_str(), &st) && st.st_size == 0;
+    }
+    data.assign(file.data, file.size);
+    return true;
+}
+
+/**
+ * Load the cache written by a previous run. An out-of-date or unreadable
+ * cache is simply ignored and rebuilt.
+**/
+static bool load_cache(const std::string &filename, des_cache &cache)
+{
+    std::string data;
+    if (!read_file(filename, data))
+        return false;
+
+    spec_list lines;
+    split(data, '\n', lines);
+    if (lines.empty() || lines[0] != CACHE_HEADER)
+        return false;
+
+    cache_entry *entry = 0;
+    std::string map;
+    for (std::size_t i = 1; i < lines.size(); ++i)
+    {
+        const std::string &line = lines[i];
+        if (line.compare(0, 2, "F ") == 0)
+        {
+            char path[4096];
+            cache_entry e;
+            if (sscanf(line.c_str(), "F %lx %lld %lld %4095[^\n]",
+                       &e.hash, &e.size, &e.mtime, path) != 4)
+            {
+                return false;
+            }
+            entry = &(cache[path] = e);
+            map.clear();
+        }
+        else if (line.compare(0, 2, "M ") == 0)
+            map = line.substr(2);
+        else if (line.compare(0, 2, "S ") == 0 && entry)
+        {
+            des_spec mons;
+            mons.map = map;
+            const std::size_t space = line.find(' ', 2);
+            if (space == std::string::npos)
+                return false;
+            mons.line = atoi(line.c_str() + 2);
+            mons.spec = unescape_cache_line(line.substr(space + 1));
+            entry->monsters.push_back(mons);
+        }
+    }
+
+    return true;
+}
+
+static void save_cache(const std::string &filename, const des_cache &cache)
+{
+    FILE *output = fopen(filename.c_str(), "w");
+    if (!output)
+    {
+        fprintf(stderr, "Unable to write %s\n", filename.c_str());
+        return;
+    }
+
+    fprintf(output, "%s\n", CACHE_HEADER);
+    for (des_cache::const_iterator i = cache.begin(); i != cache.end(); ++i)
+    {
+        fprintf(output, "F %08lx %lld %lld %s\n", i->second.hash,
+                i->second.size, i->second.mtime, i->first.c_str());
+
+        // Each map is only written when it changes.
+        std::string map;
+        for (std::size_t j = 0; j < i->second.monsters.size(); ++j)
+        {
+            const des_spec &mons = i->second.monsters[j];
+            if (mons.map != map)
+            {
+                map = mons.map;
+                fprintf(output, "M %s\n", map.c_str());
+            }
+            fprintf(output, "S %d %s\n", mons.line,
+                    escape_cache_line(mons.spec).c_str());
+        }
+    }
+    fclose(output);
+}
+
+/**
+ * Return the named monsters defined in a .des file, re-scanning it only if
+ * its contents have changed since the last run.
+ *
+ * @param cache     The per-file cache; updated if the file changed.
+ * @param path      The path of the file, relative to the des folder.
+ * @param full_path The path of the file on disk.
+ * @param verbose   If true, will note which files have been parsed.
+ * @param changed   Set to true if the cache was updated.
+ * @return The monsters, or 0 if the file could not be read.
+**/
+static const des_spec_list *scan_des_file(des_cache &cache,
+                                          const std::string &path,
+                                          const std::string &full_path,
+                                          bool verbose, bool &changed)
+{
+    struct stat st;
+    if (stat(full_path.c_str(), &st))
+        return 0;
+
+    des_cache::iterator old = cache.find(path);
+    if (old != cache.end() && old->second.size == st.st_size
+        && old->second.mtime == st.st_mtime)
+    {
+        return &old->second.monsters;
+    }
+
+    mapped_file file(full_path);
+    if (!file.data && st.st_size)
+        return 0;
+
+    const unsigned long hash =
+        crc32(crc32(0L, Z_NULL, 0),
+              reinterpret_cast<const Bytef *>(file.data), file.size);
+    changed = true;
+
+    if (old != cache.end() && old->second.hash == hash
+        && old->second.size == (long long) file.size)
+    {
+        old->second.mtime = st.st_mtime;
+        return &old->second.monsters;
+    }
+
+    if (verbose)
+        printf(" GEN %s\n", path.substr(path.rfind('/') + 1).c_str());
+
+    des_spec_list monsters;
+    parse_des_data(file.data, file.size, monsters);
+
+    cache_entry &entry = cache[path];
+    entry.hash = hash;
+    entry.size = file.size;
+    entry.mtime = st.st_mtime;
+    entry.monsters = cull_unnamed_monsters(monsters);
+    return &entry.monsters;
+}
+
+/**
+ * Return a specification as it appears in the published data.
+ *
+ * Double quotes used to be swapped for single quotes to keep the generated
+ * C++ valid; keep doing so, so that the specs don't change.
+**/
+static std::string published_spec(std::string mons)
+{
+    for (std::size_t i = 0; i < mons.size(); ++i)
+        if (mons[i] == '"')
+            mons[i] = '\'';
+    return mons;
+}
+
+/**
+ * Load the specifications listed in a prune file, as published.
+ *
+ * @return false if the file could not be read.
+**/
+static bool load_prune_file(const std::string &filename,
+                            std::set<std::string> &pruned)
+{
+    std::string data;
+    if (!read_file(filename, data))
+        return false;
+
+    spec_list lines;
+    split(data, '\n', lines);
+    for (std::size_t i = 0; i < lines.size(); ++i)
+        if (!lines[i].empty() && lines[i][0] != '#')
+            pruned.insert(unescape_cache_line(lines[i]));
+
+    return true;
+}
+
+// The specifications that vault Lua emits, by .des file.
+typedef std::map<std::string, des_spec_list> lua_specs;
+
+/**
+ * Load the specifications that vault Lua emits, as captured by monster-trunk:
+ * one line per MONS or KMONS specifier, with the file, line and map it came
+ * from, separated by tabs, after a stamp line. Unnamed monsters are left
+ * out, and so are files that would be ignored if they were scanned.
+ *
+ * @param stamp Set to the stamp line.
+ * @return false if the file could not be read.
+**/
+static bool load_lua_file(const std::string &filename, lua_specs &specs,
+                          std::string &stamp)
+{
+    std::string data;
+    if (!read_file(filename, data))
+        return false;
+
+    spec_list lines;
+    split(data, '\n', lines);
+    stamp = lines[0];
+    for (std::size_t i = 0; i < lines.size(); ++i)
+    {
+        if (lines[i].empty() || lines[i][0] == '#')
+            continue;
+
+        spec_list fields;
+        split(lines[i], '\t', fields);
+        if (fields.size() != 4)
+            continue;
+
+        const std::string &file = fields[0];
+        const std::size_t slash = file.rfind('/');
+        const std::string name =
+            slash == std::string::npos ? file : file.substr(slash + 1);
+        const std::size_t parent =
+            slash == std::string::npos ? 0 : file.rfind('/', slash - 1) + 1;
+        const std::string folder =
+            slash == std::string::npos ? "" : file.substr(parent, slash - parent);
+        if (IGNORED(name.c_str(), IGNORE_DES_FILES)
+            || IGNORED(folder.c_str(), IGNORE_DES_SUBFOLDERS))
+        {
+            continue;
+        }
+
+        spec_list monsters;
+        parse_mons_line(fields[3], monsters);
+
+        des_spec_list found;
+        des_spec mons;
+        mons.map = fields[2];
+        mons.line = atoi(fields[1].c_str());
+        for (std::size_t j = 0; j < monsters.size(); ++j)
+        {
+            mons.spec = monsters[j];
+            found.push_back(mons);
+        }
+        found = cull_unnamed_monsters(found);
+        specs[file].insert(specs[file].end(), found.begin(), found.end());
+    }
+
+    return true;
+}
+
+// The stamp that monster-trunk --capture-vault-lua puts on its first line.
+static const char *LUA_STAMP = "# monster-trunk: ";
+
+/**
+ * Return a hash of every .des file that was scanned: their paths and content
+ * hashes, in order.
+**/
+static uint32_t des_files_hash(const des_cache &files)
+{
+    uLong hash = crc32(0L, Z_NULL, 0);
+    for (des_cache::const_iterator i = files.begin(); i != files.end(); ++i)
+    {
+        const uint32_t file_hash = i->second.hash;
+        hash = crc32(hash, reinterpret_cast<const Bytef *>(i->first.c_str()),
+                     i->first.size() + 1);
+        hash = crc32(hash, reinterpret_cast<const Bytef *>(&file_hash),
+                     sizeof(file_hash));
+    }
+    return hash;
+}
+
+/**
+ * Return why the specifications captured from vault Lua are out of date, or
+ * an empty string if they aren't.
+ *
+ * @param stamp         The first line of the captured specifications.
+ * @param crawl_version The crawl version the .des files belong to.
+ * @param des_hash      The hash of the .des files.
+**/
+static std::string lua_file_staleness(const std::string &stamp,
+                                      const std::string &crawl_version,
+                                      uint32_t des_hash)
+{
+    if (stamp.compare(0, strlen(LUA_STAMP), LUA_STAMP) != 0)
+        return "it has no stamp";
+
+    spec_list fields;
+    split(stamp.substr(strlen(LUA_STAMP)), ' ', fields);
+    for (std::size_t i = 0; i < fields.size(); ++i)
+    {
+        if (fields[i].compare(0, 6, "crawl=") == 0
+            && fields[i].substr(6) != crawl_version)
+        {
+            return "it was captured from crawl " + fields[i].substr(6);
+        }
+        if (fields[i].compare(0, 4, "des=") == 0
+            && strtoul(fields[i].c_str() + 4, 0, 16) != des_hash)
+        {
+            return "the .des files have changed since it was captured";
+        }
+    }
+    return "";
+}
+
+// A .des file, map name and line.
+struct spec_source
+{
+    spec_source(const std::string &f, const std::string &m, int l)
+        : file(f), map(m), line(l)
+    {
+    }
+
+    bool operator<(const spec_source &other) const
+    {
+        if (file != other.file)
+            return file < other.file;
+        if (line != other.line)
+            return line < other.line;
+        return map < other.map;
+    }
+
+    std::string file;
+    std::string map;
+    int line;
+};
+
+// Each published specification, and everywhere it was found.
+typedef std::map<std::string, std::set<spec_source> > spec_sources;
+
+static void append_uint32s(std::string &output,
+                           const std::vector<uint32_t> &values)
+{
+    if (!values.empty())
+    {
+        output.append(reinterpret_cast<const char *>(&values[0]),
+                      values.size() * sizeof(uint32_t));
+    }
+}
+
+/**
+ * Pack a set of monster specifications into the layout described in
+ * vault_monster_format.h.
+ *
+ * @param monsters      The monster specifications to publish, as returned
+ *                      by published_spec(), and where they came from.
+ * @param crawl_version The crawl version to stamp the output with.
+ * @param des_hash      The hash of the .des files they came from.
+ * @return The contents of the generated file.
+**/
+static std::string publish_monsters(const spec_sources &monsters,
+                                    const std::string &crawl_version,
+                                    uint32_t des_hash)
+{
+    // Intern the file and map names.
+    std::map<std::string, uint32_t> names;
+    for (spec_sources::const_iterator i = monsters.begin();
+         i != monsters.end(); ++i)
+    {
+        for (std::set<spec_source>::const_iterator j = i->second.begin();
+             j != i->second.end(); ++j)
+        {
+            names[j->file] = 0;
+            names[j->map] = 0;
+        }
+    }
+    uint32_t next_name = 0;
+    for (std::map<std::string, uint32_t>::iterator i = names.begin();
+         i != names.end(); ++i)
+    {
+        i->second = next_name++;
+    }
+
+    std::vector<uint32_t> spec_offsets, spec_sources, sources, name_offsets;
+    std::string strings;
+    for (spec_sources::const_iterator i = monsters.begin();
+         i != monsters.end(); ++i)
+    {
+        spec_sources.push_back(sources.size() / 3);
+        for (std::set<spec_source>::const_iterator j = i->second.begin();
+             j != i->second.end(); ++j)
+        {
+            sources.push_back(names[j->file]);
+            sources.push_back(names[j->map]);
+            sources.push_back(j->line);
+        }
+    }
+    spec_sources.push_back(sources.size() / 3);
+
+    vault_data_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, VAULT_DATA_MAGIC, sizeof(header.magic));
+    header.version = VAULT_DATA_VERSION;
+    strncpy(header.crawl_version, crawl_version.c_str(),
+            sizeof(header.crawl_version) - 1);
+    header.des_hash = des_hash;
+    header.count = monsters.size();
+    header.source_count = sources.size() / 3;
+    header.string_count = names.size();
+
+    const std::size_t base = sizeof(header)
+        + (2 * header.count + 1 + header.string_count) * sizeof(uint32_t)
+        + header.source_count * sizeof(vault_spec_source);
+
+    for (spec_sources::const_iterator i = monsters.begin();
+         i != monsters.end(); ++i)
+    {
+        spec_offsets.push_back(base + strings.size());
+        strings += i->first;
+        strings += '\0';
+    }
+    for (std::map<std::string, uint32_t>::const_iterator i = names.begin();
+         i != names.end(); ++i)
+    {
+        name_offsets.push_back(base + strings.size());
+        strings += i->first;
+        strings += '\0';
+    }
+
+    std::string output(reinterpret_cast<const char *>(&header), sizeof(header));
+    append_uint32s(output, spec_offsets);
+    append_uint32s(output, spec_sources);
+    append_uint32s(output, sources);
+    append_uint32s(output, name_offsets);
+    output += strings;
+    return output;
+}
+
+/**
+ * Write a file, unless it already has exactly these contents; that way make
+ * doesn't rebuild anything that depends on it.
+ *
+ * @return true if the file was written.
+**/
+static bool write_if_changed(const std::string &filename,
+                             const std::string &data)
+{
+    std::string old_data;
+    if (read_file(filename, old_data) && old_data == data)
+        return false;
+
+    FILE *output = fopen(filename.c_str(), "wb");
+    if (!output || fwrite(data.data(), 1, data.size(), output) != data.size())
+    {
+        fprintf(stderr, "Unable to write %s\n", filename.c_str());
+        exit(1);
+    }
+    fclose(output);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string des_folder = DEFAULT_DES_FOLDER;
+    std::string output = DEFAULT_OUTPUT;
+    std::string prune_file = DEFAULT_PRUNE;
+    std::string lua_file = DEFAULT_LUA;
+    std::string crawl_version;
+    bool verbose = false;
+    bool force = false;
+    bool need_prune_file = false;
+    bool need_lua_file = false;
+
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help")
+        {
+            printf(USAGE, DEFAULT_DES_FOLDER, DEFAULT_OUTPUT, DEFAULT_CACHE,
+                   DEFAULT_PRUNE, DEFAULT_LUA);
+            return 0;
+        }
+        else if (arg == "-v" || arg == "--verbose")
+            verbose = true;
+        else if (arg == "-f" || arg == "--force")
+            force = true;
+        else if ((arg == "-p" || arg == "--prune") && i + 1 < argc)
+        {
+            prune_file = argv[++i];
+            need_prune_file = true;
+        }
+        else if ((arg == "-l" || arg == "--lua") && i + 1 < argc)
+        {
+            lua_file = argv[++i];
+            need_lua_file = true;
+        }
+        else if ((arg == "-c" || arg == "--crawl-version") && i + 1 < argc)
+            crawl_version = argv[++i];
+        else
+            args.push_back(arg);
+    }
+
+    if (args.size() >= 1)
+        des_folder = args[0];
+    if (args.size() >= 2)
+        output = args[1];
+
+    struct stat st;
+    if (stat(des_folder.c_str(), &st) || !S_ISDIR(st.st_mode))
+    {
+        fprintf(stderr, "Specified des folder '%s' is not a folder!\n",
+                des_folder.c_str());
+        return 1;
+    }
+
+    const std::string cache_file =
+        output.substr(0, output.rfind('.')) + ".cache";
+
+    std::set<std::string> pruned;
+    if (!load_prune_file(prune_file, pruned) && need_prune_file)
+    {
+        fprintf(stderr, "Unable to read %s\n", prune_file.c_str());
+        return 1;
+    }
+
+    lua_specs from_lua;
+    std::string lua_stamp;
+    if (!load_lua_file(lua_file, from_lua, lua_stamp) && need_lua_file)
+    {
+        fprintf(stderr, "Unable to read %s\n", lua_file.c_str());
+        return 1;
+    }
+
+    des_cache cache;
+    bool cache_changed = force || !load_cache(cache_file, cache);
+    if (force)
+        cache.clear();
+
+    std::vector<std::string> des_files;
+    find_des_files(des_folder, "", des_files);
+
+    des_cache seen;
+    spec_sources monsters;
+    for (std::size_t i = 0; i < des_files.size(); ++i)
+    {
+        const des_spec_list *found =
+            scan_des_file(cache, des_files[i], des_folder + "/" + des_files[i],
+                          verbose, cache_changed);
+        if (!found)
+        {
+            fprintf(stderr, "Unable to read %s\n", des_files[i].c_str());
+            return 1;
+        }
+        for (std::size_t j = 0; j < found->size(); ++j)
+        {
+            const des_spec &spec = (*found)[j];
+            const std::string mons = published_spec(spec.spec);
+            if (!pruned.count(mons))
+            {
+                monsters[mons].insert(
+                    spec_source(des_files[i], spec.map, spec.line));
+            }
+            else if (verbose)
+            {
+                printf(" PRUNE %s (%s:%d: %s)\n", mons.c_str(),
+                       des_files[i].c_str(), spec.line, spec.map.c_str());
+            }
+        }
+        seen[des_files[i]] = cache[des_files[i]];
+    }
+
+    const uint32_t des_hash = des_files_hash(seen);
+
+    // Stale Lua specs are still used, since most of them will still be
+    // right, until monster-trunk captures them again.
+    if (!from_lua.empty())
+    {
+        const std::string stale =
+            lua_file_staleness(lua_stamp, crawl_version, des_hash);
+        if (!stale.empty())
+        {
+            fprintf(stderr, "%s is out of date (%s); recapture it with "
+                    "monster-trunk --capture-vault-lua\n", lua_file.c_str(),
+                    stale.c_str());
+        }
+    }
+
+    // Specs that a .des file spells out are already recorded where they are
+    // written; only the ones that exist solely in vault Lua are added.
+    std::set<std::string> written;
+    for (spec_sources::const_iterator i = monsters.begin();
+         i != monsters.end(); ++i)
+    {
+        written.insert(i->first);
+    }
+    for (lua_specs::const_iterator i = from_lua.begin(); i != from_lua.end();
+         ++i)
+    {
+        for (std::size_t j = 0; j < i->second.size(); ++j)
+        {
+            const des_spec &spec = i->second[j];
+            const std::string mons = published_spec(spec.spec);
+            if (written.count(mons))
+                continue;
+            if (pruned.count(mons))
+            {
+                if (verbose)
+                {
+                    printf(" PRUNE %s (%s:%d: %s)\n", mons.c_str(),
+                           i->first.c_str(), spec.line, spec.map.c_str());
+                }
+                continue;
+            }
+            if (verbose && !monsters.count(mons))
+            {
+                printf(" LUA %s (%s:%d: %s)\n", mons.c_str(),
+                       i->first.c_str(), spec.line, spec.map.c_str());
+            }
+            monsters[mons].insert(spec_source(i->first, spec.map, spec.line));
+        }
+    }
+
+    // Forget any files that no longer exist.
+    if (seen.size() != cache.size())
+        cache_changed = true;
+
+    if (cache_changed)
+        save_cache(cache_file, seen);
+
+    if (write_if_changed(output,
+                         publish_monsters(monsters, crawl_version, des_hash))
+        && verbose)
+        printf(" GEN %s\n", output.c_str());
+
+    return 0;
+}
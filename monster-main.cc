@@ -52,9 +52,19 @@
 #include "stepdown.h"
 #include "stringutil.h"
 #include "artefact.h"
+#include "artifacts.h"
+#include "monster_names.h"
+#include "monster_resolver.h"
+#include "sample_stats.h"
+#include "vault_lua.h"
+#include "vault_index.h"
+#include "vault_monster_data.h"
 #include "vault_monsters.h"
+#include <cmath>
 #include <sstream>
 #include <set>
+#include <tuple>
+#include <sys/wait.h>
 #include <unistd.h>
 
 extern const spell_type serpent_of_hell_breaths[4][3];
@@ -383,6 +393,58 @@ static std::string mons_human_readable_spell_damage_string(
   return ("");
 }
 
+// The spell damages seen during this query, interned: damage_strings[id] is
+// the damage with that id. Ids are handed out in the order that damages are
+// first seen in.
+static std::vector<std::string> damage_strings;
+static std::map<std::string, int> damage_ids;
+
+// The id of a damage, or -1 if there is none.
+static int intern_damage(const std::string &damage) {
+  if (damage.empty())
+    return -1;
+  std::map<std::string, int>::const_iterator id = damage_ids.find(damage);
+  if (id != damage_ids.end())
+    return id->second;
+  damage_strings.push_back(damage);
+  return damage_ids[damage] = damage_strings.size() - 1;
+}
+
+static std::string damage_string(int id) {
+  return id < 0 ? "" : damage_strings[id];
+}
+
+// Spell damage already worked out during this query, by spell, caster HD
+// and caster type. Building the beam is the expensive part. The beam is
+// built with a power of 12 * HD, and neither plain monsters nor vault specs
+// can give a caster any other spell power, so for a given spell the damage
+// only depends on those.
+typedef std::tuple<spell_type, int, monster_type> spell_damage_key;
+static std::map<spell_damage_key, int> spell_damage_memos;
+
+// Whether mons_spell_beam() picks which spell to cast at random, so that a
+// spell's damage varies from cast to cast and must be worked out every time.
+static bool spell_damage_is_random(spell_type sp) {
+  return sp == SPELL_MAJOR_DESTRUCTION || sp == SPELL_LEGENDARY_DESTRUCTION;
+}
+
+// The interned damage of a spell, or -1 if it does none.
+static int spell_damage_id(monster *mp, spell_type sp) {
+  // The RNG is left as it was, so that a trial's results depend only on its
+  // seed, and not on which spells this process has already memoized.
+  rng_save_excursion exc;
+  if (spell_damage_is_random(sp))
+    return intern_damage(mons_human_readable_spell_damage_string(mp, sp));
+
+  const spell_damage_key key(sp, mp->get_experience_level(), mp->type);
+  std::map<spell_damage_key, int>::const_iterator memo =
+    spell_damage_memos.find(key);
+  if (memo != spell_damage_memos.end())
+    return memo->second;
+  return spell_damage_memos[key] =
+    intern_damage(mons_human_readable_spell_damage_string(mp, sp));
+}
+
 static std::string shorten_spell_name(std::string name) {
   lowercase(name);
   std::string::size_type pos = name.find('\'');
@@ -414,25 +476,47 @@ static std::string shorten_spell_name(std::string name) {
   return (name);
 }
 
-std::string spell_flag_string(const mon_spell_slot &slot)
+// The flags of a spell slot that are shown.
+enum shown_spell_flag {
+  SHOWN_NO_ANTIMAGIC = 1 << 0,
+  SHOWN_NO_SILENCE   = 1 << 1,
+  SHOWN_BREATH       = 1 << 2,
+  SHOWN_EMERGENCY    = 1 << 3,
+};
+
+static uint8_t shown_spell_flags(const mon_spell_slot &slot)
+{
+  uint8_t flags = 0;
+  if (!(slot.flags & MON_SPELL_ANTIMAGIC_MASK))
+    flags |= SHOWN_NO_ANTIMAGIC;
+  if (!(slot.flags & MON_SPELL_SILENCE_MASK))
+    flags |= SHOWN_NO_SILENCE;
+  if (slot.flags & MON_SPELL_BREATH)
+    flags |= SHOWN_BREATH;
+  if (slot.flags & MON_SPELL_EMERGENCY)
+    flags |= SHOWN_EMERGENCY;
+  return flags;
+}
+
+static std::string spell_flag_string(uint8_t shown)
 {
   std::string flags;
 
-  if (!(slot.flags & MON_SPELL_ANTIMAGIC_MASK))
+  if (shown & SHOWN_NO_ANTIMAGIC)
     flags += colour(LIGHTCYAN, "!AM");
-  if (!(slot.flags & MON_SPELL_SILENCE_MASK))
+  if (shown & SHOWN_NO_SILENCE)
   {
     if (!flags.empty())
       flags += ", ";
     flags += colour(MAGENTA, "!sil");
   }
-  if (slot.flags & MON_SPELL_BREATH)
+  if (shown & SHOWN_BREATH)
   {
     if (!flags.empty())
       flags += ", ";
     flags += colour(YELLOW, "breath");
   }
-  if (slot.flags & MON_SPELL_EMERGENCY)
+  if (shown & SHOWN_EMERGENCY)
   {
     if (!flags.empty())
       flags += ", ";
@@ -444,15 +528,49 @@ std::string spell_flag_string(const mon_spell_slot &slot)
   return flags;
 }
 
-// ::first is spell name, ::second is possible damages
-typedef std::multimap<std::string, std::string> spell_damage_map;
-static spell_damage_map record_spell_set(monster *mp, std::string& ret)
+// A slot of a spell set, as it is shown: the spell and its shown flags. A
+// serpent of hell's breath is a slot for each head, numbered from 1, with
+// the interned damage of its breath; other slots have neither.
+struct spell_set_slot {
+  spell_type spell;
+  uint8_t flags;
+  uint8_t head;
+  int damage;
+
+  bool operator<(const spell_set_slot &other) const {
+    return std::tie(spell, flags, head, damage)
+           < std::tie(other.spell, other.flags, other.head, other.damage);
+  }
+  bool operator==(const spell_set_slot &other) const {
+    return std::tie(spell, flags, head, damage)
+           == std::tie(other.spell, other.flags, other.head, other.damage);
+  }
+};
+typedef std::vector<spell_set_slot> spell_set;
+
+// A damage that a spell was seen to do: the spell and the interned damage.
+typedef std::pair<spell_type, int> spell_damage;
+
+// Add an item to a sorted vector, unless it is in it already.
+template <typename T>
+static void flat_set_insert(std::vector<T> &set, const T &item)
 {
-  spell_damage_map damages;
+  typename std::vector<T>::iterator pos =
+    std::lower_bound(set.begin(), set.end(), item);
+  if (pos == set.end() || !(*pos == item))
+    set.insert(pos, item);
+}
+
+// Note a monster's spell set, in slot order, and the damages of its spells.
+// Nothing is put into words until the report is printed.
+static void record_spell_set(monster *mp, spell_set &spells,
+                             std::vector<spell_damage> &damages)
+{
+  spells.clear();
+  damages.clear();
   for (std::size_t i = 0; i < mp->spells.size(); ++i) {
-    spell_type sp = mp->spells[i].spell;
-    if (!ret.empty())
-      ret += ", ";
+    const spell_type sp = mp->spells[i].spell;
+    const uint8_t flags = shown_spell_flags(mp->spells[i]);
     if (sp == SPELL_SERPENT_OF_HELL_BREATH) {
       const int idx =
             mp->type == MONS_SERPENT_OF_HELL          ? 0
@@ -463,41 +581,61 @@ static spell_damage_map record_spell_set(monster *mp, std::string& ret)
       ASSERT(idx >= 0 && idx <= 3);
       ASSERT(mp->number == ARRAYSZ(serpent_of_hell_breaths[idx]));
 
-      ret += "{";
       for (unsigned int k = 0; k < mp->number; ++k) {
         const spell_type breath = serpent_of_hell_breaths[idx][k];
-        const std::string rawname = spell_title(breath);
-        ret += k == 0 ? "" : ", ";
-        ret += make_stringf("head %d: ", k + 1) + shorten_spell_name(rawname) + " (";
-        ret += mons_human_readable_spell_damage_string(mp, breath) + ")";
+        const spell_set_slot head =
+          { breath, flags, (uint8_t) (k + 1), spell_damage_id(mp, breath) };
+        spells.push_back(head);
       }
-      ret += "}";
-
-      ret += spell_flag_string(mp->spells[i]);
     }
     else {
-      std::string spell_name = spell_title(sp);
-      spell_name = shorten_spell_name(spell_name);
-      ret += spell_name;
-      ret += spell_flag_string(mp->spells[i]);
-
-      for (int i = 0; i < 100; i++) {
-        std::string damage = mons_human_readable_spell_damage_string(mp, sp);
-        std::set<std::string> added_damages;
-        if (!damage.empty() && !added_damages.count(damage))
-        {
-          damages.insert(std::pair<std::string, std::string>(spell_name, damage));
-          added_damages.insert(damage);
-        }
+      const spell_set_slot slot = { sp, flags, 0, -1 };
+      spells.push_back(slot);
+
+      // Spells whose damage varies are sampled once per trial; the caller
+      // collects the distinct damages over all trials.
+      const int damage = spell_damage_id(mp, sp);
+      if (damage >= 0)
+        damages.push_back(spell_damage(sp, damage));
+    }
+  }
+}
+
+static std::string spell_set_string(const spell_set &spells)
+{
+  std::string ret;
+  for (unsigned int i = 0; i < spells.size(); ++i) {
+    const spell_set_slot &slot = spells[i];
+    // Later heads are shown along with the first.
+    if (slot.head > 1)
+      continue;
+    if (!ret.empty())
+      ret += ", ";
+    if (slot.head) {
+      ret += "{";
+      for (unsigned int k = i;
+           k < spells.size() && spells[k].head == k - i + 1; ++k) {
+        const std::string rawname = spell_title(spells[k].spell);
+        ret += k == i ? "" : ", ";
+        ret += make_stringf("head %d: ", spells[k].head) + shorten_spell_name(rawname) + " (";
+        ret += damage_string(spells[k].damage) + ")";
       }
+      ret += "}";
     }
+    else
+      ret += shorten_spell_name(spell_title(slot.spell));
+    ret += spell_flag_string(slot.flags);
   }
-  return damages;
+  return ret;
 }
 
-static std::string construct_spells(std::set<std::string> spells,
-                                    spell_damage_map damages)
+static std::string construct_spells(const std::vector<spell_set> &spell_sets,
+                                    const std::vector<spell_damage> &damages)
 {
+  std::set<std::string> spells;
+  for (unsigned int i = 0; i < spell_sets.size(); ++i)
+    spells.insert(spell_set_string(spell_sets[i]));
+
   std::string ret;
   for (std::set<std::string>::const_iterator i = spells.begin();
        i != spells.end(); ++i)
@@ -507,13 +645,14 @@ static std::string construct_spells(std::set<std::string> spells,
     ret += *i;
   }
   std::map<std::string, std::string> merged_spell_dam;
-  for (spell_damage_map::const_iterator i = damages.begin(); i != damages.end(); ++i)
+  for (unsigned int i = 0; i < damages.size(); ++i)
   {
-    std::string dam = merged_spell_dam[i->first];
+    const std::string name = shorten_spell_name(spell_title(damages[i].first));
+    std::string dam = merged_spell_dam[name];
     if (!dam.empty())
       dam += " / ";
-    dam += i->second;
-    merged_spell_dam[i->first] = dam;
+    dam += damage_string(damages[i].second);
+    merged_spell_dam[name] = dam;
   }
 
   for (std::map<std::string, std::string>::const_iterator i = merged_spell_dam.begin();
@@ -605,6 +744,74 @@ static void rebind_mspec(std::string *requested_name,
   }
 }
 
+// Where a vault monster spec comes from, as " [file:line (map), ...]".
+static std::string vault_spec_provenance(const std::string &spec) {
+  const int index = vault_monster_spec_index(spec);
+  if (index < 0)
+    return "";
+
+  const unsigned max_shown = 3;
+  const std::vector<vault_monster_source> sources =
+    vault_monster_sources(index);
+  std::vector<std::string> where;
+  for (unsigned i = 0; i < sources.size() && i < max_shown; ++i) {
+    where.push_back(make_stringf("%s:%d", sources[i].file, sources[i].line));
+    if (*sources[i].map)
+      where.back() += make_stringf(" (%s)", sources[i].map);
+  }
+  if (sources.size() > max_shown)
+    where.push_back(make_stringf("%u more",
+                                 (unsigned) sources.size() - max_shown));
+  if (where.empty())
+    return "";
+  return " [" + comma_separated_line(where.begin(), where.end(), " and ", ", ")
+         + "]";
+}
+
+// Append the tier that resolved a query to $MONSTER_RESOLVE_LOG, if set, to
+// see how often the slow tiers are needed.
+static void log_resolve_tier(const resolved_monster &resolved,
+                             const std::string &query) {
+  const char *log = getenv("MONSTER_RESOLVE_LOG");
+  if (!log)
+    return;
+  if (FILE *out = fopen(log, "a")) {
+    fprintf(out, "%s\t%s\n", resolve_tier_name(resolved.tier), query.c_str());
+    fclose(out);
+  }
+}
+
+// Print every vault monster that is a customised monster_name.
+static int show_vaults_for(const std::string &monster_name) {
+  const resolved_monster resolved = resolve_monster(monster_name);
+  log_resolve_tier(resolved, monster_name);
+
+  const monster_type type = static_cast<monster_type>(resolved.spec.type);
+  if (resolved.tier == RESOLVE_NONE) {
+    printf("unknown monster: \"%s\"\n", monster_name.c_str());
+    return 1;
+  }
+
+  if (!vault_index_name_count()) {
+    printf("No vault index; run make vault-index.\n");
+    return 1;
+  }
+
+  const std::string base_name = mons_type_name(type, DESC_PLAIN);
+  const std::vector<vault_index_group> groups = vault_index_for_type(type);
+  if (groups.empty()) {
+    printf("No vault monsters are based on %s.\n", base_name.c_str());
+    return 1;
+  }
+
+  printf("%u vault monster%s based on %s:\n", (unsigned) groups.size(),
+         groups.size() == 1 ? "" : "s", base_name.c_str());
+  for (unsigned i = 0; i < groups.size(); ++i)
+    printf("%s: %s\n", groups[i].name.c_str(),
+           vault_monster_spec(groups[i].spec));
+  return 0;
+}
+
 static std::string canned_reports[][2] = {
   { "cang",
     ("cang (" + colour(LIGHTRED, "Ω")
@@ -612,121 +819,544 @@ static std::string canned_reports[][2] = {
          " | Res: sanity | XP: ∞ | Int: god | Sz: !!!")) },
 };
 
-int main(int argc, char *argv[])
-{
-  alarm(5);
-  crawl_state.test = true;
-  if (argc < 2)
-  {
-    printf("Usage: @? <monster name>\n");
-    return 0;
-  }
+// How many trials to sample a monster's stats over.
+struct trial_plan {
+  int fixed;            // Run exactly this many, if not 0.
+  double confidence;    // Otherwise, how sure to be that nothing was missed.
+};
+static trial_plan sampling = { 0, 0.95 };
+
+// How many trials to sample monsters with random spells over, unless
+// --trials says otherwise, and how many of their commonest spells to show.
+const int RANDOM_SPELL_TRIALS = 1000;
+const unsigned RANDOM_SPELLS_SHOWN = 6;
+
+// Whether to sample which colours of draconian or subspecies of demonspawn a
+// query makes, and how they differ, instead of settling on the first; and
+// how many trials to sample them over, unless --trials says otherwise.
+static bool subspecies_report = false;
+const int SUBSPECIES_TRIALS = 1000;
+
+// How many worker processes to sample trials in; 0 for one per CPU.
+static int trial_workers = 0;
+
+// The seed each query starts from, if --seed was given; otherwise queries
+// are seeded at random.
+static bool fixed_seed = false;
+static uint32_t query_seed = 0;
+
+// Whether to follow the report with the distribution of each sampled stat.
+static bool detailed_report = false;
+
+// Adaptive sampling stops once it is sampling.confidence sure that no
+// outcome this likely per trial has been missed...
+const double RARE_TRIAL_OUTCOME = 0.1;
+// ...or after this many trials, whatever happens.
+const int MAX_TRIALS = 500;
+
+// How many trials in a row must show nothing new before sampling stops.
+static int stable_trials_needed(double confidence) {
+  if (confidence <= 0)
+    return 1;
+  if (confidence >= 1)
+    return MAX_TRIALS;
+  return (int) ceil(log(1 - confidence) / log(1 - RARE_TRIAL_OUTCOME));
+}
 
-  if (!strcmp(argv[1], "-version") || !strcmp(argv[1], "--version"))
-  {
-    printf("Monster stats Crawl version: %s\n", Version::Long);
-    return 0;
-  }
-  else if (!strcmp(argv[1], "-name") || !strcmp(argv[1], "--name"))
-  {
-    seed_rng();
-    string name = make_name(random_int(), MNAME_DEFAULT);
-    printf("%s\n", name.c_str());
-    return 0;
-  }
+// What the trials so far have shown: the HP and speed ranges, the average
+// XP, AC and EV, and how many spell sets and damages were seen.
+typedef std::tuple<int, int, int, int, long, int, int, size_t, size_t>
+  trial_summary;
+
+// A sampled stat's distribution, for the detailed report.
+static std::string describe_distribution(const char *name,
+                                         const stat_accumulator &stat) {
+  return make_stringf("%s: mean %.1f, sd %.1f, 10/50/90%%: %.0f/%.0f/%.0f",
+                      name, stat.mean(), stat.stddev(), stat.percentile(0.1),
+                      stat.percentile(0.5), stat.percentile(0.9));
+}
 
-  initialize_crawl();
+// What one trial's copy of the monster was like. Every trial is seeded from
+// the query's seed and its number alone, so it comes out the same whichever
+// process runs it.
+struct trial_result {
+  monster_type type;
+  int hd;
+  int hit_points;
+  int ac, ev;
+  int speed;
+  long exper;
+  bool has_items;
+  monster_type subspecies;  // The colour or subspecies, if it has one.
+  spell_set spells;
+  std::vector<spell_damage> damages;
+};
 
-  mons_list mons;
-  std::string target = argv[1];
+// How many trials each worker runs, at least, when they are split up.
+const int MIN_TRIALS_PER_WORKER = 4;
+
+// The usual time limit for a query, in seconds, and how many trials it was
+// sized for.
+const int QUERY_TIME_LIMIT = 5;
+const int TRIALS_PER_TIME_LIMIT = 100;
+
+// How long to allow for ntrials trials split between nworkers processes:
+// the usual time limit for each hundred trials a worker runs.
+static int trial_time_limit(int ntrials, int nworkers) {
+  const int per_worker = (ntrials + nworkers - 1) / nworkers;
+  return QUERY_TIME_LIMIT
+         * std::max(1, (per_worker + TRIALS_PER_TIME_LIMIT - 1)
+                       / TRIALS_PER_TIME_LIMIT);
+}
 
-  if (argc > 2)
-    for (int x = 2; x < argc; x++)
-    {
-      target.append(" ");
-      target.append(argv[x]);
-    }
+// The most trials any query can run.
+static int query_trial_limit() {
+  if (sampling.fixed)
+    return sampling.fixed;
+  return std::max(MAX_TRIALS, subspecies_report ? SUBSPECIES_TRIALS
+                                                : RANDOM_SPELL_TRIALS);
+}
 
-  trim_string(target);
+// A trial's seed, mixed from the query's seed and the trial's number.
+static uint32_t trial_seed(uint32_t base, int trial) {
+  uint32_t x = base + 0x9e3779b9U * (uint32_t) (trial + 1);
+  x = (x ^ (x >> 16)) * 0x85ebca6bU;
+  x = (x ^ (x >> 13)) * 0xc2b2ae35U;
+  return x ^ (x >> 16);
+}
 
-  const bool want_vault_spec = target.find("spec:") == 0;
-  if (want_vault_spec)
-  {
-    target.erase(0, 5);
-    trim_string(target);
-  }
+// HP, AC and EV worked out from the monster's entry instead of sampled, for
+// monsters whose spec and equipment can't change them.
+struct analytic_stats {
+  bool hp;              // Whether the HP range is exact.
+  bool defences;        // Whether AC and EV are exact.
+  monster_type type;
+  int hd;
+  int hp_min, hp_max;
+  double hp_mean;
+  int ac, ev;
+};
 
-  // [ds] Nobody mess with cang.
-  for (unsigned i = 0; i < sizeof(canned_reports) / sizeof(*canned_reports);
-       ++i)
-  {
-    if (canned_reports[i][0] == target)
-    {
-      printf("%s\n", canned_reports[i][1].c_str());
-      return 0;
+static bool monster_has_items(const monster &mon) {
+  for (int slot = 0; slot < NUM_MONSTER_SLOTS; ++slot)
+    if (mon.inv[slot] != NON_ITEM)
+      return true;
+  return false;
+}
+
+// Drop whichever analytic stats a trial's copy of the monster contradicts.
+static void check_analytic_stats(analytic_stats &stats,
+                                 const trial_result &trial) {
+  if (trial.type != stats.type)
+    stats.hp = stats.defences = false;
+  if (trial.hd != stats.hd
+      || trial.hit_points < stats.hp_min || trial.hit_points > stats.hp_max)
+    stats.hp = false;
+  if (trial.has_items || trial.ac != stats.ac || trial.ev != stats.ev)
+    stats.defences = false;
+}
+
+// Work out a monster's HP range and its AC and EV from its entry: each HD
+// gives hpdice[1] HP plus up to hpdice[2] more, and hpdice[3] is added once.
+// This only applies if the spec doesn't override them, and the monster is
+// always the same type; every trial is checked against it too.
+static analytic_stats analytic_monster_stats(const mons_spec &spec,
+                                             const monster &mon) {
+  analytic_stats stats = analytic_stats();
+  stats.type = mon.type;
+
+  const monsterentry *me = get_monster_data(mon.type);
+  if (!me || mon.type != spec.type || spec.hd || spec.hp
+      || mons_class_is_zombified(mon.type) || mons_is_ghost_demon(mon.type)
+      || mons_class_is_chimeric(mon.type) || mon.is_shapeshifter())
+    return stats;
+
+  stats.hd      = me->hpdice[0];
+  stats.hp_min  = stats.hd * me->hpdice[1] + me->hpdice[3];
+  stats.hp_max  = stats.hd * (me->hpdice[1] + me->hpdice[2]) + me->hpdice[3];
+  stats.hp_mean = stats.hd * (me->hpdice[1] + me->hpdice[2] / 2.0)
+                  + me->hpdice[3];
+  stats.ac      = me->AC;
+  stats.ev      = me->ev;
+  stats.hp       = true;
+  stats.defences = spec.items.empty();
+  return stats;
+}
+
+// Place the copy of the monster for a trial.
+static int place_trial_monster(const mons_spec &spec, uint32_t seed) {
+  seed_rng(seed);
+  return mi_create_monster(spec);
+}
+
+// Note what a trial's copy of the monster is like, and destroy it.
+static trial_result finish_trial(monster *mp, const mons_spec &spec) {
+  trial_result trial;
+  trial.type       = mp->type;
+  trial.hd         = mp->get_experience_level();
+  trial.hit_points = mp->hit_points;
+  trial.ac         = mp->armour_class();
+  trial.ev         = mp->evasion();
+  trial.speed      = mp->speed;
+  trial.exper      = exper_value(mp);
+  trial.has_items  = monster_has_items(*mp);
+  trial.subspecies =
+    mons_species(mp->type) == MONS_DRACONIAN
+    || mons_species(mp->type) == MONS_DEMONSPAWN
+    ? draco_or_demonspawn_subspecies(mp) : MONS_NO_MONSTER;
+  record_spell_set(mp, trial.spells, trial.damages);
+
+  mp->reset();
+  you.unique_creatures.set(static_cast<monster_type>(spec.type), false);
+  return trial;
+}
+
+// The numbers of a trial, as a worker sends them back. The damages it
+// interns are sent ahead of the first trial that uses them, and referred to
+// by the worker's ids for them.
+struct trial_record {
+  int32_t type;
+  int32_t hd;
+  int32_t hit_points;
+  int32_t ac, ev;
+  int32_t speed;
+  int64_t exper;
+  uint8_t has_items;
+  int32_t subspecies;
+  uint32_t spell_count;     // Followed by the slots of its spell set,
+  uint32_t damage_count;    // and then its spell damages.
+};
+
+// Run trials first up to first + count in a worker, and send them to fd.
+static void run_trial_worker(const mons_spec &spec, uint32_t base, int first,
+                             int count, int fd) {
+  FILE *out = fdopen(fd, "w");
+  unsigned int sent = 0;
+  for (int t = first; t < first + count; ++t) {
+    const int index = place_trial_monster(spec, trial_seed(base, t));
+    if (index < 0)
+      break;
+    const trial_result trial = finish_trial(&menv[index], spec);
+
+    for (; sent < damage_strings.size(); ++sent) {
+      const uint32_t size = damage_strings[sent].size();
+      fputc('S', out);
+      fwrite(&size, sizeof size, 1, out);
+      fwrite(damage_strings[sent].data(), 1, size, out);
     }
+
+    trial_record record;
+    record.type         = trial.type;
+    record.hd           = trial.hd;
+    record.hit_points   = trial.hit_points;
+    record.ac           = trial.ac;
+    record.ev           = trial.ev;
+    record.speed        = trial.speed;
+    record.exper        = trial.exper;
+    record.has_items    = trial.has_items;
+    record.subspecies   = trial.subspecies;
+    record.spell_count  = trial.spells.size();
+    record.damage_count = trial.damages.size();
+
+    fputc('T', out);
+    fwrite(&record, sizeof record, 1, out);
+    if (!trial.spells.empty())
+      fwrite(&trial.spells[0], sizeof(spell_set_slot), trial.spells.size(),
+             out);
+    if (!trial.damages.empty())
+      fwrite(&trial.damages[0], sizeof(spell_damage), trial.damages.size(),
+             out);
   }
+  fclose(out);
+}
 
-  std::string orig_target = std::string(target);
+// Read the trials a worker sent, until it stopped. The damages it interned
+// are interned here too.
+static void read_trial_worker(FILE *in, std::vector<trial_result> &trials) {
+  std::vector<int> damages;     // Our ids for the worker's damages.
+  int tag;
+  while ((tag = fgetc(in)) != EOF) {
+    if (tag == 'S') {
+      uint32_t size;
+      if (fread(&size, sizeof size, 1, in) != 1)
+        return;
+      std::string damage(size, '\0');
+      if (size && fread(&damage[0], 1, size, in) != size)
+        return;
+      damages.push_back(intern_damage(damage));
+      continue;
+    }
 
-  std::string err = mons.add_mons(target, false);
-  if (!err.empty()) {
-    target = "the " + target;
-    const std::string test = mons.add_mons(target, false);
-    if (test.empty())
-      err = test;
+    trial_record record;
+    if (tag != 'T' || fread(&record, sizeof record, 1, in) != 1)
+      return;
+
+    trial_result trial;
+    trial.type       = static_cast<monster_type>(record.type);
+    trial.hd         = record.hd;
+    trial.hit_points = record.hit_points;
+    trial.ac         = record.ac;
+    trial.ev         = record.ev;
+    trial.speed      = record.speed;
+    trial.exper      = record.exper;
+    trial.has_items  = record.has_items;
+    trial.subspecies = static_cast<monster_type>(record.subspecies);
+    trial.spells.resize(record.spell_count);
+    trial.damages.resize(record.damage_count);
+    if (!trial.spells.empty()
+        && fread(&trial.spells[0], sizeof(spell_set_slot),
+                 trial.spells.size(), in) != trial.spells.size()
+        || !trial.damages.empty()
+           && fread(&trial.damages[0], sizeof(spell_damage),
+                    trial.damages.size(), in) != trial.damages.size())
+      return;
+
+    for (unsigned int i = 0; i < trial.spells.size(); ++i) {
+      int &damage = trial.spells[i].damage;
+      if (damage >= (int) damages.size())
+        return;
+      if (damage >= 0)
+        damage = damages[damage];
+    }
+    for (unsigned int i = 0; i < trial.damages.size(); ++i) {
+      int &damage = trial.damages[i].second;
+      if (damage < 0 || damage >= (int) damages.size())
+        return;
+      damage = damages[damage];
+    }
+    trials.push_back(trial);
   }
+}
 
-  mons_spec spec = mons.get_monster(0);
-  monster_type spec_type = static_cast<monster_type>(spec.type);
-  bool vault_monster = false;
-  string vault_spec;
+// Run trials first up to first + count, split between the workers, and put
+// them in trials in order; trials must start out empty. Trials that a worker
+// failed to send back are run here instead; they come out the same either
+// way.
+static bool run_trials(const mons_spec &spec, uint32_t base, int first,
+                       int count, std::vector<trial_result> &trials) {
+  const int nworkers = std::min(trial_workers, count / MIN_TRIALS_PER_WORKER);
+  std::vector<pid_t> pids;
+  std::vector<int> fds;
+
+  fflush(stdout);
+  for (int w = 0; w < nworkers; ++w) {
+    int pipefd[2];
+    if (pipe(pipefd))
+      break;
 
-  if ((spec_type < 0 || spec_type >= NUM_MONSTERS
-       || spec_type == MONS_PLAYER_GHOST)
-      || !err.empty())
-  {
-    spec = get_vault_monster(orig_target, &vault_spec);
-    spec_type = static_cast<monster_type>(spec.type);
-    if (spec_type < 0 || spec_type >= NUM_MONSTERS
-        || spec_type == MONS_PLAYER_GHOST)
-    {
-      if (err.empty())
-        printf("unknown monster: \"%s\"\n", target.c_str());
-      else
-        printf("%s\n", err.c_str());
-      return 1;
+    const int start = first + w * count / nworkers;
+    const int end = first + (w + 1) * count / nworkers;
+    const pid_t pid = fork();
+    if (pid == 0) {
+      close(pipefd[0]);
+      run_trial_worker(spec, base, start, end - start, pipefd[1]);
+      _exit(0);
     }
 
-    // get_vault_monster created the monster; make uniques ungenerated again
-    if (mons_is_unique(spec_type))
-      you.unique_creatures.set(spec_type, false);
+    close(pipefd[1]);
+    if (pid < 0) {
+      close(pipefd[0]);
+      break;
+    }
+    pids.push_back(pid);
+    fds.push_back(pipefd[0]);
+  }
 
-    vault_monster = true;
+  std::vector<std::vector<trial_result> > sent(pids.size());
+  for (unsigned w = 0; w < pids.size(); ++w) {
+    FILE *in = fdopen(fds[w], "r");
+    read_trial_worker(in, sent[w]);
+    fclose(in);
+    waitpid(pids[w], NULL, 0);
   }
 
-  if (want_vault_spec)
-  {
-    if (!vault_monster)
-    {
-      printf("Not a vault monster: %s\n", orig_target.c_str());
-      return 1;
+  // The last pass runs whatever no worker was started for.
+  for (unsigned w = 0; w <= sent.size(); ++w) {
+    int end = first + count;
+    if (w < sent.size()) {
+      trials.insert(trials.end(), sent[w].begin(), sent[w].end());
+      end = first + (w + 1) * count / nworkers;
     }
-    else
-    {
-      printf("%s: %s\n", orig_target.c_str(), vault_spec.c_str());
-      return 0;
+    for (int t = first + trials.size(); t < end; ++t) {
+      const int index = place_trial_monster(spec, trial_seed(base, t));
+      if (index < 0)
+        return false;
+      trials.push_back(finish_trial(&menv[index], spec));
     }
   }
+  return true;
+}
 
-  int index = mi_create_monster(spec);
+// Whether each copy of a monster has spells of its own, picked at random, so
+// that listing the spell sets seen would be no use.
+static bool has_random_spells(const monster &mon, monster_type spec_type) {
+  return mon.is_shapeshifter()
+         || spec_type == MONS_SHAPESHIFTER
+         || spec_type == MONS_GLOWING_SHAPESHIFTER
+         || mon.type == MONS_PANDEMONIUM_LORD
+         || mon.type == MONS_LICH
+         || mon.type == MONS_ANCIENT_LICH
+         || mon.type == MONS_CHIMERA
+            && (mon.base_monster == MONS_PANDEMONIUM_LORD
+                || mon.base_monster == MONS_LICH
+                || mon.base_monster == MONS_ANCIENT_LICH);
+}
+
+static std::string trial_frequency(int count, int ntrials) {
+  return make_stringf("%.1f%%", 100.0 * count / ntrials);
+}
+
+// Things seen in trials, commonest first, with how many trials each was
+// seen in.
+template <typename T>
+static std::vector<std::pair<int, T> >
+by_frequency(const std::map<T, int> &counts) {
+  std::vector<std::pair<int, T> > sorted;
+  for (typename std::map<T, int>::const_iterator i = counts.begin();
+       i != counts.end(); ++i)
+    sorted.push_back(std::make_pair(-i->second, i->first));
+  std::sort(sorted.begin(), sorted.end());
+  for (unsigned i = 0; i < sorted.size(); ++i)
+    sorted[i].first = -sorted[i].first;
+  return sorted;
+}
+
+// The commonest spells of a monster with random spells, as
+// "(random; of N sets seen: spell 12.3%, ...)".
+static std::string random_spell_summary(
+  const std::map<spell_type, int> &spell_counts,
+  const std::map<spell_set, int> &set_counts, int ntrials) {
+  const std::vector<std::pair<int, spell_type> > common =
+    by_frequency(spell_counts);
+  std::string ret = make_stringf("(random; %u sets seen",
+                                 (unsigned) set_counts.size());
+  for (unsigned i = 0; i < common.size() && i < RANDOM_SPELLS_SHOWN; ++i) {
+    ret += i ? ", " : ": ";
+    ret += shorten_spell_name(spell_title(common[i].second)) + " "
+           + trial_frequency(common[i].first, ntrials);
+  }
+  if (common.size() > RANDOM_SPELLS_SHOWN)
+    ret += ", ...";
+  return ret + ")";
+}
+
+// What the trials of one colour of draconian or subspecies of demonspawn
+// were like.
+struct subspecies_stats {
+  subspecies_stats() : count(0) { }
+
+  int count;
+  stat_accumulator hp, ac, ev;
+  std::set<spell_type> breaths;
+};
+
+// Print how often each colour or subspecies came up, and how they differ:
+// their resistances, breaths, and average HP, AC and EV.
+static void show_subspecies(
+  const std::map<monster_type, subspecies_stats> &subspecies, int ntrials) {
+  if (subspecies.empty()) {
+    printf("Not a draconian or demonspawn; no subspecies to show.\n");
+    return;
+  }
+
+  std::map<monster_type, int> counts;
+  for (std::map<monster_type, subspecies_stats>::const_iterator i =
+         subspecies.begin(); i != subspecies.end(); ++i)
+    counts[i->first] = i->second.count;
+  const std::vector<std::pair<int, monster_type> > common =
+    by_frequency(counts);
+
+  printf("Subspecies over %d trials:\n", ntrials);
+  for (unsigned i = 0; i < common.size(); ++i) {
+    const monster_type type = common[i].second;
+    const subspecies_stats &stats = subspecies.find(type)->second;
+    printf("  %s: %s | HP: ~%.1f | AC/EV: ~%.1f/%.1f",
+           mons_type_name(type, DESC_PLAIN).c_str(),
+           trial_frequency(common[i].first, ntrials).c_str(),
+           stats.hp.mean(), stats.ac.mean(), stats.ev.mean());
+
+    std::string resistances, vulnerabilities;
+    if (const monsterentry *me = get_monster_data(type)) {
+      record_resist(RED, "fire", resistances, vulnerabilities,
+                    get_resist(me->resists, MR_RES_FIRE));
+      record_resist(BLUE, "cold", resistances, vulnerabilities,
+                    get_resist(me->resists, MR_RES_COLD));
+      record_resist(CYAN, "elec", resistances, vulnerabilities,
+                    get_resist(me->resists, MR_RES_ELEC));
+      record_resist(GREEN, "poison", resistances, vulnerabilities,
+                    get_resist(me->resists, MR_RES_POISON));
+      record_resist(BROWN, "acid", resistances, vulnerabilities,
+                    get_resist(me->resists, MR_RES_ACID));
+      record_resist(0, "steam", resistances, vulnerabilities,
+                    get_resist(me->resists, MR_RES_STEAM));
+    }
+    printf("%s%s", resistances.c_str(), vulnerabilities.c_str());
+
+    std::vector<std::string> breaths;
+    for (std::set<spell_type>::const_iterator b = stats.breaths.begin();
+         b != stats.breaths.end(); ++b)
+      breaths.push_back(shorten_spell_name(spell_title(*b)));
+    if (!breaths.empty())
+      printf(" | Breath: %s",
+             comma_separated_line(breaths.begin(), breaths.end(), ", ", ", ")
+             .c_str());
+    printf(".\n");
+  }
+}
+
+// Place a monster and print its stats, sampled over many copies of it,
+// until they stop changing. HP, AC and EV that can be worked out exactly
+// are, and don't need to settle; numbers that were sampled are marked "~".
+// After the first, the trials are run in batches split between worker
+// processes; they are still looked at one by one and in order, so the report
+// is the same however many workers there are. Monsters with random spells
+// are sampled a fixed, larger number of times, and their spells are given
+// by how often they were seen.
+static int show_monster_report(mons_spec spec, std::string target,
+                               bool vault_monster) {
+  const monster_type spec_type = static_cast<monster_type>(spec.type);
+  spell_damage_memos.clear();
+  damage_strings.clear();
+  damage_ids.clear();
+
+  // Reseed for every query, so that it doesn't depend on what ran before.
+  if (fixed_seed)
+    seed_rng(query_seed);
+  const uint32_t base_seed = fixed_seed ? query_seed : random_int();
+  int index = place_trial_monster(spec, trial_seed(base_seed, 0));
   if (index < 0 || index >= MAX_MONSTERS) {
     printf("Failed to create test monster for %s\n", target.c_str());
     return 1;
   }
 
-  const int ntrials = 100;
-
+  analytic_stats analytic = analytic_monster_stats(spec, menv[index]);
+
+  // The first trial is run here, since it may settle which coloured
+  // draconian or demonspawn the rest should be.
+  const std::string first_name = menv[index].name(DESC_PLAIN, true);
+  const bool random_spells = has_random_spells(menv[index], spec_type);
+  std::vector<trial_result> batch(1, finish_trial(&menv[index], spec));
+  if (!subspecies_report)
+    rebind_mspec(&target, first_name, &spec);
+
+  const int stable_needed = stable_trials_needed(sampling.confidence);
+  const int fixed_trials = sampling.fixed ? sampling.fixed
+                           : subspecies_report ? SUBSPECIES_TRIALS
+                           : random_spells ? RANDOM_SPELL_TRIALS
+                           : 0;
+  const int trial_limit = fixed_trials ? fixed_trials : MAX_TRIALS;
+  const int batch_size = fixed_trials ? fixed_trials
+                         : std::max(stable_needed + 1,
+                                    trial_workers * MIN_TRIALS_PER_WORKER);
+
+  // Allow as long as the most trials this could run take.
+  alarm(trial_time_limit(trial_limit,
+                         std::max(1, std::min(trial_workers,
+                                              batch_size
+                                              / MIN_TRIALS_PER_WORKER))));
+  int ntrials = 0;
+  int stable = 0;
+  trial_summary last_seen;
 
   long exper = 0L;
   int hp_min = 0;
@@ -734,56 +1364,104 @@ int main(int argc, char *argv[])
   int mac = 0;
   int mev = 0;
   int speed_min = 0, speed_max = 0;
+  stat_accumulator hp_stats, ac_stats, ev_stats, xp_stats, speed_stats;
   // Calculate averages.
-  std::set<std::string> spells;
-  spell_damage_map damages;
-  for (int i = 0; i < ntrials; ++i) {
-    monster *mp = &menv[index];
-    const std::string mname = mp->name(DESC_PLAIN, true);
-    exper += exper_value(mp);
-    mac += mp->armour_class();
-    mev += mp->evasion();
-    set_min_max(mp->speed, speed_min, speed_max);
-    set_min_max(mp->hit_points, hp_min, hp_max);
-
-    std::string new_spells;
-    const spell_damage_map new_damages = record_spell_set(mp, new_spells);
-    for (spell_damage_map::const_iterator i = new_damages.begin(); i != new_damages.end(); ++i)
-    {
-      bool skip = false;
-      std::pair<spell_damage_map::iterator, spell_damage_map::iterator> old_damages;
-      old_damages = damages.equal_range(i->first);
-      for (spell_damage_map::iterator j = old_damages.first; j != old_damages.second; ++j)
-      {
-        if (j->second == i->second)
-        {
-          skip = true;
-          break;
-        }
+  std::vector<spell_set> spells;
+  std::vector<spell_damage> damages;
+  // How many trials each spell set and spell was seen in, for monsters with
+  // random spells.
+  std::map<spell_set, int> spell_set_counts;
+  std::map<spell_type, int> spell_counts;
+  std::vector<spell_type> trial_spells;
+  std::map<monster_type, subspecies_stats> subspecies;
+  for (bool done = false; !done; ) {
+    for (unsigned t = 0; t < batch.size() && !done; ++t) {
+      const trial_result &trial = batch[t];
+      exper += trial.exper;
+      mac += trial.ac;
+      mev += trial.ev;
+      set_min_max(trial.speed, speed_min, speed_max);
+      set_min_max(trial.hit_points, hp_min, hp_max);
+      check_analytic_stats(analytic, trial);
+      hp_stats.add(trial.hit_points);
+      ac_stats.add(trial.ac);
+      ev_stats.add(trial.ev);
+      xp_stats.add(trial.exper);
+      speed_stats.add(trial.speed);
+
+      for (unsigned int i = 0; i < trial.damages.size(); ++i)
+        flat_set_insert(damages, trial.damages[i]);
+      if (!trial.spells.empty())
+        flat_set_insert(spells, trial.spells);
+      if (random_spells) {
+        ++spell_set_counts[trial.spells];
+        trial_spells.clear();
+        for (unsigned int i = 0; i < trial.spells.size(); ++i)
+          trial_spells.push_back(trial.spells[i].spell);
+        std::sort(trial_spells.begin(), trial_spells.end());
+        trial_spells.erase(std::unique(trial_spells.begin(),
+                                       trial_spells.end()),
+                           trial_spells.end());
+        for (unsigned int i = 0; i < trial_spells.size(); ++i)
+          ++spell_counts[trial_spells[i]];
+      }
+      if (subspecies_report && trial.subspecies != MONS_NO_MONSTER) {
+        subspecies_stats &sub = subspecies[trial.subspecies];
+        ++sub.count;
+        sub.hp.add(trial.hit_points);
+        sub.ac.add(trial.ac);
+        sub.ev.add(trial.ev);
+        for (unsigned int i = 0; i < trial.spells.size(); ++i)
+          if (trial.spells[i].flags & SHOWN_BREATH)
+            sub.breaths.insert(trial.spells[i].spell);
       }
-      if (skip) continue;
-      damages.insert(*i);
-    }
-    if (!new_spells.empty())
-      spells.insert(new_spells);
-
-    // Destroy the monster.
-    mp->reset();
-    you.unique_creatures.set(spec_type, false);
 
-    rebind_mspec(&target, mname, &spec);
+      const int seen_trials = ntrials + 1;
+      const trial_summary seen(analytic.hp ? 0 : hp_min,
+                               analytic.hp ? 0 : hp_max,
+                               speed_min, speed_max, exper / seen_trials,
+                               analytic.defences ? 0 : mac / seen_trials,
+                               analytic.defences ? 0 : mev / seen_trials,
+                               spells.size(), damages.size());
+      stable = ntrials && seen == last_seen ? stable + 1 : 0;
+      last_seen = seen;
+
+      ++ntrials;
+      done = fixed_trials ? ntrials >= fixed_trials
+                            : stable >= stable_needed || ntrials >= MAX_TRIALS;
+    }
 
-    index = mi_create_monster(spec);
-    if (index == -1) {
-      printf("Unexpected failure generating monster for %s\n",
-             target.c_str());
-      return 1;
+    if (!done) {
+      batch.clear();
+      if (!run_trials(spec, base_seed, ntrials,
+                      std::min(batch_size, trial_limit - ntrials), batch)) {
+        printf("Unexpected failure generating monster for %s\n",
+               target.c_str());
+        return 1;
+      }
     }
   }
+
+  // The monster to describe is the one a serial run would have placed next.
+  index = place_trial_monster(spec, trial_seed(base_seed, ntrials));
+  if (index == -1) {
+    printf("Unexpected failure generating monster for %s\n",
+           target.c_str());
+    return 1;
+  }
   exper /= ntrials;
   mac /= ntrials;
   mev /= ntrials;
 
+  if (analytic.hp) {
+    hp_min = analytic.hp_min;
+    hp_max = analytic.hp_max;
+  }
+  if (analytic.defences) {
+    mac = analytic.ac;
+    mev = analytic.ev;
+  }
+
   monster &mon(menv[index]);
 
   const std::string symbol(monster_symbol(mon));
@@ -833,7 +1511,7 @@ int main(int argc, char *argv[])
     const int hd = mon.get_experience_level();
     printf(" | HD: %d", hd);
 
-    printf(" | HP: ");
+    printf(" | HP: %s", analytic.hp ? "" : "~");
     const int hplow = hp_min;
     const int hphigh = hp_max;
     if (hplow < hphigh)
@@ -841,7 +1519,7 @@ int main(int argc, char *argv[])
     else
         printf("%i", hplow);
 
-    printf(" | AC/EV: %i/%i", mac, mev);
+    printf(" | AC/EV: %s%i/%i", analytic.defences ? "" : "~", mac, mev);
 
     std::string defenses;
     if (mon.is_spiny() > 0)
@@ -1131,16 +1809,11 @@ int main(int argc, char *argv[])
     mons_check_flag(mon.is_unbreathing(), monsterflags, "unbreathing");
 
     std::string spell_string = construct_spells(spells, damages);
-    if (shapeshifter
-        || mon.type == MONS_PANDEMONIUM_LORD
-        || mon.type == MONS_LICH
-        || mon.type == MONS_ANCIENT_LICH
-        || mon.type == MONS_CHIMERA
-           && (mon.base_monster == MONS_PANDEMONIUM_LORD
-               || mon.base_monster == MONS_LICH
-               || mon.base_monster == MONS_ANCIENT_LICH))
+    if (random_spells || has_random_spells(mon, spec_type))
     {
-      spell_string = "(random)";
+      spell_string = spell_counts.empty()
+        ? "(random)"
+        : random_spell_summary(spell_counts, spell_set_counts, ntrials);
     }
 
     mons_check_flag(vault_monster, monsterflags, colour(BROWN, "vault"));
@@ -1258,11 +1931,336 @@ int main(int argc, char *argv[])
 
     printf(".\n");
 
+    if (detailed_report) {
+      const std::string hp_mean = analytic.hp
+        ? make_stringf("HP: mean %.1f exactly", analytic.hp_mean)
+        : describe_distribution("HP", hp_stats);
+      printf("Over %d trials: %s | %s | %s | %s | %s.\n", ntrials,
+             hp_mean.c_str(), describe_distribution("AC", ac_stats).c_str(),
+             describe_distribution("EV", ev_stats).c_str(),
+             describe_distribution("XP", xp_stats).c_str(),
+             describe_distribution("Spd", speed_stats).c_str());
+
+      if (!spell_counts.empty()) {
+        const std::vector<std::pair<int, spell_type> > by_spell =
+          by_frequency(spell_counts);
+        printf("Spells over %d trials:", ntrials);
+        for (unsigned i = 0; i < by_spell.size(); ++i)
+          printf("%s %s %s", i ? "," : "",
+                 shorten_spell_name(spell_title(by_spell[i].second)).c_str(),
+                 trial_frequency(by_spell[i].first, ntrials).c_str());
+        printf(".\n");
+
+        const std::vector<std::pair<int, spell_set> > by_set =
+          by_frequency(spell_set_counts);
+        printf("Spell sets over %d trials:\n", ntrials);
+        for (unsigned i = 0; i < by_set.size(); ++i)
+          printf("  %s: %s\n",
+                 trial_frequency(by_set[i].first, ntrials).c_str(),
+                 spell_set_string(by_set[i].second).c_str());
+      }
+    }
+
+    if (subspecies_report)
+      show_subspecies(subspecies, ntrials);
+
     return 0;
   }
   return 1;
 }
 
+// Print the report of every vault monster called name, one line each after
+// the spec it came from. Each variant is sampled in a worker process of its
+// own, up to one per CPU at a time.
+static int show_variants(const std::string &name) {
+  if (!vault_index_name_count()) {
+    printf("No vault index; run make vault-index.\n");
+    return 1;
+  }
+
+  std::vector<vault_index_group> groups =
+    vault_index_find(canonical_monster_name(name));
+  if (groups.empty())
+    groups = vault_index_find(name);
+  if (groups.empty()) {
+    printf("Not a vault monster: %s\n", name.c_str());
+    return 1;
+  }
+
+  const int nvariants = groups.size();
+  const int nworkers =
+    std::max(1, std::min((int) sysconf(_SC_NPROCESSORS_ONLN), nvariants));
+
+  // Each worker samples its variant alone, for up to the most trials a
+  // query can run, so allow that long per batch of them.
+  alarm(trial_time_limit(query_trial_limit(), 1)
+        * ((nvariants + nworkers - 1) / nworkers));
+
+  fflush(stdout);
+  for (int first = 0; first < nvariants; first += nworkers) {
+    const int last = std::min(nvariants, first + nworkers);
+    std::vector<pid_t> pids;
+    std::vector<int> fds;
+
+    for (int v = first; v < last; ++v) {
+      int pipefd[2];
+      if (pipe(pipefd)) {
+        printf("Unable to sample the variants of %s\n", name.c_str());
+        return 1;
+      }
+
+      const pid_t pid = fork();
+      if (pid == 0) {
+        alarm(QUERY_TIME_LIMIT);
+        close(pipefd[0]);
+        dup2(pipefd[1], STDOUT_FILENO);
+        close(pipefd[1]);
+
+        // The variants are already split between the CPUs.
+        trial_workers = 1;
+        mons_list mons;
+        const char *spec = vault_monster_spec(groups[v].spec);
+        const int status = mons.add_mons(spec, false).empty()
+          ? show_monster_report(mons.get_monster(0), name, true)
+          : 1;
+        fflush(stdout);
+        _exit(status);
+      }
+
+      close(pipefd[1]);
+      if (pid < 0) {
+        close(pipefd[0]);
+        printf("Unable to sample the variants of %s\n", name.c_str());
+        return 1;
+      }
+      pids.push_back(pid);
+      fds.push_back(pipefd[0]);
+    }
+
+    for (int v = first; v < last; ++v) {
+      std::string report;
+      char buf[4096];
+      ssize_t got;
+      while ((got = read(fds[v - first], buf, sizeof buf)) > 0)
+        report.append(buf, got);
+      close(fds[v - first]);
+      waitpid(pids[v - first], NULL, 0);
+
+      const char *spec = vault_monster_spec(groups[v].spec);
+      printf("Variant %d of %d: %s%s\n", v + 1, nvariants, spec,
+             vault_spec_provenance(spec).c_str());
+      if (report.empty())
+        printf("Failed to create test monster for %s\n", spec);
+      else
+        printf("%s", report.c_str());
+    }
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  alarm(QUERY_TIME_LIMIT);
+  crawl_state.test = true;
+  if (argc < 2)
+  {
+    printf("Usage: @? [--trials N] [--confidence C] [--workers N] [--seed N]"
+           " [--detail] [--subspecies] <monster name>\n");
+    return 0;
+  }
+
+  if (!strcmp(argv[1], "-version") || !strcmp(argv[1], "--version"))
+  {
+    printf("Monster stats Crawl version: %s\n", Version::Long);
+    return 0;
+  }
+  else if (!strcmp(argv[1], "-name") || !strcmp(argv[1], "--name"))
+  {
+    seed_rng();
+    string name = make_name(random_int(), MNAME_DEFAULT);
+    printf("%s\n", name.c_str());
+    return 0;
+  }
+  else if (!strcmp(argv[1], "--validate-vault-specs"))
+  {
+    // Placing every vault monster takes far longer than a single query.
+    alarm(0);
+    initialize_crawl();
+    const std::string prune_file =
+      argc > 2 ? argv[2] : "vault_monster_invalid.txt";
+    return validate_vault_specs(prune_file) < 0;
+  }
+  else if (!strcmp(argv[1], "--benchmark-vault-names"))
+  {
+    alarm(0);
+    // Parsing the specs for their names needs crawl's monster data.
+    initialize_crawl();
+    benchmark_vault_name_compare();
+    return 0;
+  }
+  else if (!strcmp(argv[1], "--build-vault-index"))
+  {
+    alarm(0);
+    initialize_crawl();
+    const std::string index_file =
+      argc > 2 ? argv[2] : "vault_monster_index.bin";
+    return build_vault_index(index_file) < 0;
+  }
+  else if (!strcmp(argv[1], "--check-artifact") && argc > 2)
+  {
+    // Exits with 0 if the file is up to date, for make.
+    const std::string stale = artifact_staleness(argv[2]);
+    if (stale.empty())
+      return 0;
+    printf("%s is stale: %s\n", argv[2], stale.c_str());
+    return 1;
+  }
+  else if (!strcmp(argv[1], "--artifact-stamp"))
+  {
+    const artifact_source source =
+      argc > 2 && !strcmp(argv[2], "des") ? ARTIFACT_FROM_DES
+                                          : ARTIFACT_FROM_VAULT_DATA;
+    printf("%s%s\n", ARTIFACT_STAMP_PREFIX, artifact_stamp(source).c_str());
+    return 0;
+  }
+  else if (!strcmp(argv[1], "--capture-vault-lua"))
+  {
+    alarm(0);
+    initialize_crawl();
+    const std::string lua_file = argc > 2 ? argv[2] : "vault_monster_lua.txt";
+    const std::string crawl_dir =
+      argc > 3 ? argv[3] : "crawl-ref/crawl-ref/source";
+    return capture_vault_lua_specs(lua_file, crawl_dir) < 0;
+  }
+
+  std::string target;
+  for (int x = 1; x < argc; x++)
+  {
+    if (!strcmp(argv[x], "--trials") && x + 1 < argc)
+      sampling.fixed = std::max(1, atoi(argv[++x]));
+    else if (!strcmp(argv[x], "--confidence") && x + 1 < argc)
+      sampling.confidence = atof(argv[++x]);
+    else if (!strcmp(argv[x], "--detail"))
+      detailed_report = true;
+    else if (!strcmp(argv[x], "--workers") && x + 1 < argc)
+      trial_workers = std::max(1, atoi(argv[++x]));
+    else if (!strcmp(argv[x], "--subspecies"))
+      subspecies_report = true;
+    else if (!strcmp(argv[x], "--seed") && x + 1 < argc)
+    {
+      fixed_seed = true;
+      query_seed = strtoul(argv[++x], NULL, 0);
+    }
+    else
+    {
+      target.append(" ");
+      target.append(argv[x]);
+    }
+  }
+
+  trim_string(target);
+  if (target.empty())
+  {
+    printf("Usage: @? [--trials N] [--confidence C] [--workers N] [--seed N]"
+           " [--detail] [--subspecies] <monster name>\n");
+    return 0;
+  }
+  if (!trial_workers)
+    trial_workers = std::max(1, (int) sysconf(_SC_NPROCESSORS_ONLN));
+
+  // Completion only needs the monster names, not a dungeon to place
+  // monsters in; it is called on every keystroke.
+  if (target.find("complete:") == 0)
+  {
+    init_monsters();
+    const std::vector<std::string> completions =
+      complete_monster_names(trimmed_string(target.substr(9)));
+    for (unsigned i = 0; i < completions.size(); ++i)
+      printf("%s\n", completions[i].c_str());
+    return 0;
+  }
+
+  initialize_crawl();
+  if (fixed_seed)
+    seed_rng(query_seed);
+
+  if (target.find("vaults-for:") == 0)
+    return show_vaults_for(trimmed_string(target.substr(11)));
+
+  if (target.find("variants:") == 0)
+    return show_variants(trimmed_string(target.substr(9)));
+
+  const bool want_vault_spec = target.find("spec:") == 0;
+  if (want_vault_spec)
+  {
+    target.erase(0, 5);
+    trim_string(target);
+  }
+
+  // [ds] Nobody mess with cang.
+  for (unsigned i = 0; i < sizeof(canned_reports) / sizeof(*canned_reports);
+       ++i)
+  {
+    if (canned_reports[i][0] == target)
+    {
+      printf("%s\n", canned_reports[i][1].c_str());
+      return 0;
+    }
+  }
+
+  std::string orig_target = std::string(target);
+
+  const resolved_monster resolved = resolve_monster(target);
+  log_resolve_tier(resolved, orig_target);
+
+  if (resolved.tier == RESOLVE_NONE)
+  {
+    const std::vector<std::string> suggestions =
+      suggest_monster_names(orig_target);
+    const std::string did_you_mean = suggestions.empty() ? "" :
+      " (did you mean: "
+      + comma_separated_line(suggestions.begin(), suggestions.end(),
+                             ", ", ", ")
+      + "?)";
+
+    if (resolved.error.empty())
+      printf("unknown monster: \"%s\"%s\n", orig_target.c_str(),
+             did_you_mean.c_str());
+    else
+      printf("%s%s\n", resolved.error.c_str(), did_you_mean.c_str());
+    return 1;
+  }
+
+  target = resolved.name;
+  mons_spec spec = resolved.spec;
+  const monster_type spec_type = static_cast<monster_type>(spec.type);
+  const bool vault_monster = !resolved.vault_spec.empty();
+  const string vault_spec = resolved.vault_spec;
+
+  // get_vault_monster may have created the monster; make uniques
+  // ungenerated again
+  if (vault_monster && mons_is_unique(spec_type))
+    you.unique_creatures.set(spec_type, false);
+
+  if (want_vault_spec)
+  {
+    if (!vault_monster)
+    {
+      printf("Not a vault monster: %s\n", orig_target.c_str());
+      return 1;
+    }
+    else
+    {
+      printf("%s: %s%s\n", orig_target.c_str(), vault_spec.c_str(),
+             vault_spec_provenance(vault_spec).c_str());
+      return 0;
+    }
+  }
+
+  return show_monster_report(spec, target, vault_monster);
+}
+
 template <class T> inline std::string to_string (const T& t)
 {
   std::stringstream ss;
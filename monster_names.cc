@@ -0,0 +1,280 @@
+/**
+ * @file monster_names.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Every name that monster-trunk knows: the base monsters, and the vault
+ * monsters in the vault index. Complete names from a prefix, and when a name
+ * doesn't resolve, suggest the closest of these by trigram similarity.
+ *
+ * Each name's trigrams are hashed into a fixed-size bit signature, and the
+ * signatures are packed into one array, so that scoring every name is a
+ * single flat pass of ANDs and popcounts. Only the best few are then scored
+ * exactly. Completion runs in a fresh process on every keystroke, so the
+ * signatures are built separately from the names, and only when a
+ * suggestion is wanted.
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "mon-util.h"
+#include "monster_names.h"
+#include "stringutil.h"
+#include "vault_index.h"
+#include "vault_monsters.h"
+
+#include <algorithm>
+
+// 512 bits per signature: few enough collisions for names of up to a few
+// dozen characters.
+#define SIGNATURE_BITS  512
+#define SIGNATURE_WORDS (SIGNATURE_BITS / 64)
+
+// Suggestions must be at least this similar (Dice coefficient of trigrams)
+// to be worth showing.
+static const double MIN_SIMILARITY = 0.3;
+
+// How many candidates from the signature pass are scored exactly, per
+// suggestion wanted.
+static const int RESCORE_FACTOR = 8;
+
+struct monster_name_table
+{
+    std::vector<std::string> keys;      // Sorted, as from vault_name_key().
+    std::vector<std::string> display;   // What to show for each key.
+};
+
+// The trigram signature of each key of the monster_name_table, and how many
+// bits it has set.
+struct monster_name_signatures
+{
+    std::vector<uint64_t> signatures;
+    std::vector<int>      signature_bits;
+};
+
+/**
+ * Return the trigrams of a name key, padded so that the start and end of the
+ * name count for more, sorted and without duplicates.
+**/
+static std::vector<uint32_t> name_trigrams (const std::string &key)
+{
+    const std::string padded = "  " + key + " ";
+    std::vector<uint32_t> trigrams;
+    for (unsigned int i = 0; i + 2 < padded.size(); ++i)
+    {
+        trigrams.push_back((uint8_t) padded[i] << 16
+                           | (uint8_t) padded[i + 1] << 8
+                           | (uint8_t) padded[i + 2]);
+    }
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()),
+                   trigrams.end());
+    return (trigrams);
+}
+
+static void name_signature (const std::vector<uint32_t> &trigrams,
+                            uint64_t *signature)
+{
+    memset(signature, 0, SIGNATURE_WORDS * sizeof(*signature));
+    for (unsigned int i = 0; i < trigrams.size(); ++i)
+    {
+        const uint32_t bit = (trigrams[i] * 2654435761u) % SIGNATURE_BITS;
+        signature[bit / 64] |= (uint64_t) 1 << (bit % 64);
+    }
+}
+
+static int signature_popcount (const uint64_t *signature)
+{
+    int bits = 0;
+    for (int w = 0; w < SIGNATURE_WORDS; ++w)
+        bits += __builtin_popcountll(signature[w]);
+    return (bits);
+}
+
+static void add_monster_name (monster_name_table &table,
+                              const std::string &name)
+{
+    table.keys.push_back(vault_name_key(name));
+    table.display.push_back(name);
+}
+
+/**
+ * Return every monster name, built the first time it is needed.
+**/
+static const monster_name_table &monster_names ()
+{
+    static monster_name_table table;
+    static bool built = false;
+
+    if (built)
+        return (table);
+    built = true;
+
+    for (int i = 0; i < NUM_MONSTERS; ++i)
+    {
+        const monster_type mc = static_cast<monster_type>(i);
+        if (invalid_monster_type(mc) || mc == MONS_PLAYER_GHOST)
+            continue;
+        add_monster_name(table, mons_type_name(mc, DESC_PLAIN));
+    }
+    for (int i = 0, count = vault_index_name_count(); i < count; ++i)
+        add_monster_name(table, vault_index_name(i));
+
+    // Drop duplicate keys, keeping the base monster's spelling of them.
+    std::vector<int> order(table.keys.size());
+    for (unsigned int i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(),
+                     [](int a, int b)
+                     { return table.keys[a] < table.keys[b]; });
+
+    monster_name_table unique;
+    for (unsigned int i = 0; i < order.size(); ++i)
+    {
+        if (i && table.keys[order[i]] == table.keys[order[i - 1]])
+            continue;
+        unique.keys.push_back(table.keys[order[i]]);
+        unique.display.push_back(table.display[order[i]]);
+    }
+    table = unique;
+
+    return (table);
+}
+
+/**
+ * Return the signature of every monster name, built the first time it is
+ * needed.
+**/
+static const monster_name_signatures &monster_name_signature_table ()
+{
+    static monster_name_signatures sigs;
+    static bool built = false;
+
+    if (built)
+        return (sigs);
+    built = true;
+
+    const monster_name_table &table = monster_names();
+    sigs.signatures.resize(table.keys.size() * SIGNATURE_WORDS);
+    sigs.signature_bits.resize(table.keys.size());
+    for (unsigned int i = 0; i < table.keys.size(); ++i)
+    {
+        uint64_t *signature = &sigs.signatures[i * SIGNATURE_WORDS];
+        name_signature(name_trigrams(table.keys[i]), signature);
+        sigs.signature_bits[i] = signature_popcount(signature);
+    }
+
+    return (sigs);
+}
+
+/**
+ * Complete a monster name.
+ *
+ * Only needs init_monsters(), so that completing doesn't have to set up
+ * anything that placing a monster would.
+ *
+ * @param prefix          The start of a name; case and apostrophes don't
+ *                        matter.
+ * @param max_completions The most names to return.
+ * @return The base or vault monster names that start with prefix, in
+ *         alphabetical order.
+**/
+std::vector<std::string> complete_monster_names (const std::string &prefix,
+                                                 int max_completions)
+{
+    const monster_name_table &table = monster_names();
+    const std::string key = vault_name_key(prefix);
+
+    std::vector<std::string> completions;
+    for (std::vector<std::string>::const_iterator i =
+             std::lower_bound(table.keys.begin(), table.keys.end(), key);
+         i != table.keys.end() && starts_with(*i, key)
+         && (int) completions.size() < max_completions; ++i)
+    {
+        completions.push_back(table.display[i - table.keys.begin()]);
+    }
+    return (completions);
+}
+
+/**
+ * Return the Dice coefficient of two sorted sets of trigrams.
+**/
+static double trigram_similarity (const std::vector<uint32_t> &a,
+                                  const std::vector<uint32_t> &b)
+{
+    if (a.empty() && b.empty())
+        return (0);
+
+    unsigned int i = 0, j = 0, shared = 0;
+    while (i < a.size() && j < b.size())
+    {
+        if (a[i] < b[j])
+            ++i;
+        else if (b[j] < a[i])
+            ++j;
+        else
+            ++shared, ++i, ++j;
+    }
+    return (2.0 * shared / (a.size() + b.size()));
+}
+
+/**
+ * Suggest monster names that look like one that didn't resolve.
+ *
+ * @param name            The name that was asked for.
+ * @param max_suggestions The most names to return.
+ * @return The closest base or vault monster names, best first; empty if
+ *         nothing is close enough.
+**/
+std::vector<std::string> suggest_monster_names (const std::string &name,
+                                                int max_suggestions)
+{
+    const monster_name_table &table = monster_names();
+    const monster_name_signatures &sigs = monster_name_signature_table();
+    const int count = table.keys.size();
+
+    const std::vector<uint32_t> trigrams = name_trigrams(vault_name_key(name));
+    uint64_t query[SIGNATURE_WORDS];
+    name_signature(trigrams, query);
+    const int query_bits = signature_popcount(query);
+
+    // Approximate similarity of every name from the signatures alone.
+    std::vector<float> scores(count);
+    const uint64_t *signatures = count ? &sigs.signatures[0] : 0;
+    for (int i = 0; i < count; ++i)
+    {
+        const uint64_t *signature = signatures + i * SIGNATURE_WORDS;
+        int shared = 0;
+        for (int w = 0; w < SIGNATURE_WORDS; ++w)
+            shared += __builtin_popcountll(signature[w] & query[w]);
+        scores[i] = 2.0f * shared / (query_bits + sigs.signature_bits[i]);
+    }
+
+    std::vector<int> candidates(count);
+    for (int i = 0; i < count; ++i)
+        candidates[i] = i;
+    const int rescore = std::min(count, max_suggestions * RESCORE_FACTOR);
+    std::partial_sort(candidates.begin(), candidates.begin() + rescore,
+                      candidates.end(),
+                      [&scores](int a, int b) { return scores[a] > scores[b]; });
+
+    std::vector<std::pair<double, int> > exact;
+    for (int i = 0; i < rescore; ++i)
+    {
+        const double similarity =
+            trigram_similarity(trigrams,
+                               name_trigrams(table.keys[candidates[i]]));
+        if (similarity >= MIN_SIMILARITY)
+            exact.push_back(std::make_pair(-similarity, candidates[i]));
+    }
+    std::sort(exact.begin(), exact.end());
+
+    std::vector<std::string> suggestions;
+    for (unsigned int i = 0;
+         i < exact.size() && (int) suggestions.size() < max_suggestions; ++i)
+    {
+        suggestions.push_back(table.display[exact[i].second]);
+    }
+    return (suggestions);
+}
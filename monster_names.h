@@ -0,0 +1,15 @@
+/**
+ * monster_names.h
+**/
+
+#ifndef __MONSTER_NAMES_H__
+#define __MONSTER_NAMES_H__
+
+#include "AppHdr.h"
+
+std::vector<std::string> complete_monster_names (const std::string &prefix,
+                                                 int max_completions = 10);
+std::vector<std::string> suggest_monster_names (const std::string &name,
+                                                int max_suggestions = 3);
+
+#endif
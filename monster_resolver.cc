@@ -0,0 +1,358 @@
+/**
+ * @file monster_resolver.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Turn the name that was asked for into a monster spec. The name is put into
+ * canonical form once, and then tried against each way of resolving it in
+ * turn, cheapest first:
+ *
+ *   - the names of the base monsters, in a perfect hash table;
+ *   - the names of vault monsters, in the vault index;
+ *   - crawl's own monster spec parser;
+ *   - naming every vault monster spec, if there is no vault index.
+ *
+ * The caller is told which of these answered.
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "mon-util.h"
+#include "monster_resolver.h"
+#include "stringutil.h"
+#include "vault_index.h"
+#include "vault_monster_data.h"
+#include "vault_monsters.h"
+
+#include <algorithm>
+
+// Leading words that don't change which monster is meant.
+static const char *MONSTER_ARTICLES[] = { "the ", "a ", "an " };
+
+// Names that players use for monsters, and the monsters they mean.
+static const char *MONSTER_ALIASES[][2] =
+{
+    { "dema", "deep elf master archer" },
+    { "oof",  "orb of fire" },
+};
+
+/**
+ * Return a name as a key: as vault_name_key() does, but with runs of spaces
+ * collapsed and, if strip_article, without a leading article.
+**/
+static std::string monster_key (const std::string &name, bool strip_article)
+{
+    const std::string key = vault_name_key(name);
+
+    std::string collapsed;
+    for (std::string::size_type i = 0; i < key.size(); ++i)
+        if (key[i] != ' ' || collapsed.empty() || collapsed.back() != ' ')
+            collapsed += key[i];
+
+    if (strip_article)
+    {
+        for (unsigned int i = 0; i < ARRAYSZ(MONSTER_ARTICLES); ++i)
+        {
+            if (starts_with(collapsed, MONSTER_ARTICLES[i]))
+            {
+                collapsed.erase(0, strlen(MONSTER_ARTICLES[i]));
+                break;
+            }
+        }
+    }
+
+    return (collapsed);
+}
+
+/**
+ * Return the canonical form of a monster name: lowercase, without
+ * apostrophes, extra spaces or a leading article, and with aliases replaced
+ * by the names they stand for.
+ *
+ * @param name The name that was asked for.
+**/
+std::string canonical_monster_name (const std::string &name)
+{
+    const std::string key = monster_key(name, true);
+    for (unsigned int i = 0; i < ARRAYSZ(MONSTER_ALIASES); ++i)
+        if (key == MONSTER_ALIASES[i][0])
+            return (MONSTER_ALIASES[i][1]);
+    return (key);
+}
+
+static uint32_t name_hash (const std::string &key, uint32_t seed)
+{
+    uint32_t hash = 2166136261u ^ seed;
+    for (std::string::size_type i = 0; i < key.size(); ++i)
+    {
+        hash ^= (uint8_t) key[i];
+        hash *= 16777619u;
+    }
+    return (hash);
+}
+
+/**
+ * A perfect hash table of base monster names: each name is put in a bucket,
+ * and each bucket has a displacement that gives every name in it a slot of
+ * its own. A lookup is three hashes and one string comparison.
+ *
+ * If no displacement fits some bucket, the table is rebuilt with other
+ * hashes and more slots; if that keeps failing, the names are looked up in
+ * a sorted list instead.
+**/
+class base_name_table
+{
+public:
+    base_name_table () : perfect(false)
+    {
+        for (int i = 0; i < NUM_MONSTERS; ++i)
+        {
+            const monster_type mc = static_cast<monster_type>(i);
+            if (!resolves_by_name(mc))
+                continue;
+
+            const std::string key =
+                canonical_monster_name(mons_type_name(mc, DESC_PLAIN));
+            if (std::find(keys.begin(), keys.end(), key) == keys.end())
+            {
+                keys.push_back(key);
+                types.push_back(mc);
+            }
+        }
+
+        unsigned int nslots = 1;
+        while (nslots < 2 * keys.size())
+            nslots *= 2;
+        for (uint32_t attempt = 0; attempt < MAX_BUILDS && !perfect;
+             ++attempt, nslots *= 2)
+        {
+            perfect = build(nslots, attempt);
+        }
+
+        if (!perfect)
+        {
+            std::vector<int> order(keys.size());
+            for (unsigned int i = 0; i < order.size(); ++i)
+                order[i] = i;
+            std::sort(order.begin(), order.end(),
+                      [this](int a, int b) { return keys[a] < keys[b]; });
+            std::vector<std::string> sorted_keys;
+            std::vector<monster_type> sorted_types;
+            for (unsigned int i = 0; i < order.size(); ++i)
+            {
+                sorted_keys.push_back(keys[order[i]]);
+                sorted_types.push_back(types[order[i]]);
+            }
+            keys.swap(sorted_keys);
+            types.swap(sorted_types);
+        }
+    }
+
+    /**
+     * Return the base monster with a name, or MONS_NO_MONSTER.
+     *
+     * @param key The name, as returned by canonical_monster_name().
+    **/
+    monster_type find (const std::string &key) const
+    {
+        if (!perfect)
+        {
+            std::vector<std::string>::const_iterator i =
+                std::lower_bound(keys.begin(), keys.end(), key);
+            return (i != keys.end() && *i == key ? types[i - keys.begin()]
+                                                 : MONS_NO_MONSTER);
+        }
+
+        const uint32_t d =
+            displacements[bucket_for(key) % displacements.size()];
+        const uint32_t slot = slot_for(key, d);
+        return (slot_keys[slot] == key ? slot_types[slot] : MONS_NO_MONSTER);
+    }
+
+private:
+    // How many times to try building the table before giving up on it.
+    static const uint32_t MAX_BUILDS = 4;
+
+    /**
+     * Try to lay the names out in nslots slots, with the given choice of
+     * hashes. Fails if some bucket fits no displacement; since the step
+     * between a name's slots is odd and the slots are a power of two, every
+     * displacement up to nslots has been tried by then.
+    **/
+    bool build (unsigned int nslots, uint32_t attempt)
+    {
+        seed = 3 * attempt;
+        mask = nslots - 1;
+        slot_keys.assign(nslots, "");
+        slot_types.assign(nslots, MONS_NO_MONSTER);
+
+        std::vector<std::vector<int> > buckets(std::max<size_t>(1, keys.size() / 4));
+        for (unsigned int i = 0; i < keys.size(); ++i)
+            buckets[bucket_for(keys[i]) % buckets.size()].push_back(i);
+        displacements.assign(buckets.size(), 0);
+
+        // Place the biggest buckets first, while there is the most room.
+        std::vector<int> order(buckets.size());
+        for (unsigned int i = 0; i < order.size(); ++i)
+            order[i] = i;
+        std::sort(order.begin(), order.end(),
+                  [&buckets](int a, int b)
+                  { return buckets[a].size() > buckets[b].size(); });
+
+        std::vector<bool> used(nslots, false);
+        for (unsigned int b = 0; b < order.size(); ++b)
+        {
+            const std::vector<int> &bucket = buckets[order[b]];
+            bool placed = false;
+            for (uint32_t d = 0; d < nslots && !placed; ++d)
+            {
+                std::vector<uint32_t> slots;
+                bool fits = true;
+                for (unsigned int i = 0; i < bucket.size() && fits; ++i)
+                {
+                    const uint32_t slot = slot_for(keys[bucket[i]], d);
+                    fits = !used[slot] && std::find(slots.begin(), slots.end(),
+                                                    slot) == slots.end();
+                    slots.push_back(slot);
+                }
+                if (!fits)
+                    continue;
+
+                displacements[order[b]] = d;
+                for (unsigned int i = 0; i < bucket.size(); ++i)
+                {
+                    used[slots[i]] = true;
+                    slot_keys[slots[i]] = keys[bucket[i]];
+                    slot_types[slots[i]] = types[bucket[i]];
+                }
+                placed = true;
+            }
+            if (!placed)
+                return (false);
+        }
+        return (true);
+    }
+
+    uint32_t bucket_for (const std::string &key) const
+    {
+        return (name_hash(key, seed));
+    }
+
+    uint32_t slot_for (const std::string &key, uint32_t d) const
+    {
+        return ((name_hash(key, seed + 1)
+                 + d * (name_hash(key, seed + 2) | 1)) & mask);
+    }
+
+    /**
+     * Whether the spec for a monster's bare name is just its type. The
+     * spec parser gives draconians, demonspawn and derived undead random
+     * parts, so they are left to it.
+    **/
+    static bool resolves_by_name (monster_type mc)
+    {
+        return (!invalid_monster_type(mc) && mc != MONS_PLAYER_GHOST
+                && !mons_class_is_zombified(mc)
+                && mons_genus(mc) != MONS_DRACONIAN
+                && mons_genus(mc) != MONS_DEMONSPAWN);
+    }
+
+    bool perfect;       // Whether the hash table was built.
+    uint32_t seed;
+    uint32_t mask;
+    std::vector<std::string> keys;      // Sorted, if the table wasn't built.
+    std::vector<monster_type> types;
+    std::vector<uint32_t> displacements;
+    std::vector<std::string> slot_keys;
+    std::vector<monster_type> slot_types;
+};
+
+static bool valid_resolved_type (int type)
+{
+    return (type >= 0 && type < NUM_MONSTERS && type != MONS_PLAYER_GHOST);
+}
+
+/**
+ * Resolve a monster name, trying the cheapest ways first.
+ *
+ * @param name The name that was asked for; a monster spec will also do.
+ * @return The monster's spec and how it was found, with a tier of
+ *         RESOLVE_NONE if it wasn't.
+**/
+resolved_monster resolve_monster (const std::string &name)
+{
+    static const base_name_table base_names;
+
+    resolved_monster result;
+    result.tier = RESOLVE_NONE;
+    result.name = trimmed_string(name);
+
+    const std::string key = canonical_monster_name(name);
+
+    const monster_type type = base_names.find(key);
+    if (type != MONS_NO_MONSTER)
+    {
+        result.tier = RESOLVE_BASE_NAME;
+        result.spec = mons_spec(type);
+        return (result);
+    }
+
+    // A vault monster may be called "the something" in its own right.
+    std::vector<vault_index_group> groups = vault_index_find(key);
+    if (groups.empty())
+        groups = vault_index_find(monster_key(name, false));
+    if (!groups.empty())
+    {
+        mons_list mons;
+        const char *spec = vault_monster_spec(groups[0].spec);
+        if (mons.add_mons(spec, false).empty())
+        {
+            result.tier = RESOLVE_VAULT_INDEX;
+            result.spec = mons.get_monster(0);
+            result.vault_spec = spec;
+            return (result);
+        }
+    }
+
+    mons_list mons;
+    result.error = mons.add_mons(result.name, false);
+    if (!result.error.empty()
+        && mons.add_mons("the " + result.name, false).empty())
+    {
+        result.error.clear();
+        result.name = "the " + result.name;
+    }
+    if (result.error.empty() && valid_resolved_type(mons.get_monster(0).type))
+    {
+        result.tier = RESOLVE_SPEC_PARSE;
+        result.spec = mons.get_monster(0);
+        return (result);
+    }
+
+    const mons_spec vault = get_vault_monster(name, &result.vault_spec);
+    if (valid_resolved_type(vault.type))
+    {
+        result.tier = RESOLVE_VAULT_SCAN;
+        result.spec = vault;
+        result.name = trimmed_string(name);
+        result.error.clear();
+    }
+
+    return (result);
+}
+
+/**
+ * Return a short name for a resolve tier, for logs.
+**/
+const char *resolve_tier_name (resolve_tier tier)
+{
+    switch (tier)
+    {
+    case RESOLVE_BASE_NAME:   return "base";
+    case RESOLVE_VAULT_INDEX: return "vault-index";
+    case RESOLVE_SPEC_PARSE:  return "spec";
+    case RESOLVE_VAULT_SCAN:  return "vault-scan";
+    default:                  return "none";
+    }
+}
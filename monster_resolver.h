@@ -0,0 +1,34 @@
+/**
+ * monster_resolver.h
+**/
+
+#ifndef __MONSTER_RESOLVER_H__
+#define __MONSTER_RESOLVER_H__
+
+#include "AppHdr.h"
+#include "mapdef.h"
+
+// How a monster name was resolved, cheapest first.
+enum resolve_tier
+{
+    RESOLVE_NONE,           // It wasn't.
+    RESOLVE_BASE_NAME,      // The name of a base monster.
+    RESOLVE_VAULT_INDEX,    // A vault monster, from the vault index.
+    RESOLVE_SPEC_PARSE,     // A monster spec, as a vault would write it.
+    RESOLVE_VAULT_SCAN,     // A vault monster, by naming every vault spec.
+};
+
+struct resolved_monster
+{
+    resolve_tier tier;
+    mons_spec spec;
+    std::string name;        // The name that resolved.
+    std::string vault_spec;  // The vault spec used, for vault monsters.
+    std::string error;       // Why it didn't resolve, if the spec parser says.
+};
+
+std::string canonical_monster_name (const std::string &name);
+resolved_monster resolve_monster (const std::string &name);
+const char *resolve_tier_name (resolve_tier tier);
+
+#endif
@@ -16,10 +16,11 @@ DEFAULTS:
     dc-mon.txt          %s
 """
 
-import re, sys, parse_des, os, subprocess
+import re, sys, os, struct, subprocess
 
 DEFAULT_CRAWL_FOLDER = "crawl-ref/crawl-ref/source"
 DEFAULT_OUTPUT = "tile_info.txt"
+VAULT_MONSTER_DATA = "vault_monster_data.bin"
 DC_MON_LOCATION = os.path.join(DEFAULT_CRAWL_FOLDER, "rltiles", "dc-mon.txt")
 
 class TileParseError (Exception):
@@ -31,6 +32,29 @@ class TileParseError (Exception):
 
 GET_TILE = re.compile("tile:([^ ]*)")
 
+# See vault_monster_format.h.
+VAULT_DATA_MAGIC = "VMONDAT\0"
+VAULT_DATA_VERSION = 4
+VAULT_DATA_HEADER = "=8sI64sIIII"
+
+def read_vault_monsters (filename):
+    """
+    Return the list of monster specifications packed into ``filename`` by
+    des-scanner.
+    """
+    fn = open(filename, "rb")
+    data = fn.read()
+    fn.close()
+
+    magic, version, crawl_version, des_hash, count, sources, strings = \
+        struct.unpack_from(VAULT_DATA_HEADER, data)
+    if magic != VAULT_DATA_MAGIC or version != VAULT_DATA_VERSION:
+        raise TileParseError, "%s is not usable vault data" % filename
+
+    offsets = struct.unpack_from("=%dI" % count, data,
+                                 struct.calcsize(VAULT_DATA_HEADER))
+    return [data[offset:data.index("\0", offset)] for offset in offsets]
+
 def parse_tile_data (data):
     tiles = {}
     cur_dir = ""
@@ -76,7 +100,7 @@ def main (args):
         verbose = True
 
     try:
-        assert os.path.exists(parse_des.DEFAULT_OUTPUT)
+        assert os.path.exists(VAULT_MONSTER_DATA)
         assert os.path.exists("monster-trunk")
     except AssertionError:
         if verbose:
@@ -90,22 +114,23 @@ def main (args):
     if verbose:
         print "GEN %s" % output_file
 
-    fn = open(parse_des.DEFAULT_OUTPUT)
-    data = fn.readlines()
-    fn.close()
-
     check_lines = []
 
-    for line in data:
+    for line in read_vault_monsters(VAULT_MONSTER_DATA):
         if "tile:" in line:
             check_lines.append(line)
 
+    # Stamp the output with the crawl version and the vault data it was made
+    # from, so that make can tell when it is stale.
+    stamp = subprocess.Popen(["./monster-trunk", "--artifact-stamp"],
+                             stdout=subprocess.PIPE).communicate()[0]
+
     output = open(output_file, "w")
+    output.write(stamp)
 
     done = []
 
     for line in check_lines:
-        line = line.split('"', 1)[1].split('"', 1)[0]
         result = subprocess.Popen(["./monster-trunk", line], stdout=subprocess.PIPE)
         name = result.stdout.read().split(" (", 1)[0].lower().replace("'", "")
         tile = GET_TILE.findall(line)[0].upper()
@@ -0,0 +1,104 @@
+/**
+ * @file sample_stats.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Streaming statistics for the numbers sampled over a monster's trials, so
+ * that the report can say what is usual as well as what is possible, without
+ * keeping every sample.
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "sample_stats.h"
+
+#include <cmath>
+
+stat_accumulator::stat_accumulator ()
+    : n(0), m(0), m2(0), low(0), high(0), origin(0), width(1)
+{
+    memset(bins, 0, sizeof(bins));
+}
+
+/**
+ * Add a sample.
+ *
+ * The first sample anchors the histogram. A sample above its range merges
+ * pairs of bins, doubling their width; one below it also moves the origin
+ * down, so that the old bins become the upper half.
+**/
+void stat_accumulator::add (double value)
+{
+    if (!n)
+    {
+        origin = floor(value);
+        low = high = value;
+    }
+    low  = std::min(low, value);
+    high = std::max(high, value);
+
+    ++n;
+    const double delta = value - m;
+    m  += delta / n;
+    m2 += delta * (value - m);
+
+    while (value >= origin + width * STAT_HISTOGRAM_BINS)
+    {
+        for (int i = 0; i < STAT_HISTOGRAM_BINS / 2; ++i)
+            bins[i] = bins[2 * i] + bins[2 * i + 1];
+        for (int i = STAT_HISTOGRAM_BINS / 2; i < STAT_HISTOGRAM_BINS; ++i)
+            bins[i] = 0;
+        width *= 2;
+    }
+    while (value < origin)
+    {
+        for (int i = STAT_HISTOGRAM_BINS - 1; i >= STAT_HISTOGRAM_BINS / 2; --i)
+        {
+            const int old = 2 * (i - STAT_HISTOGRAM_BINS / 2);
+            bins[i] = bins[old] + bins[old + 1];
+        }
+        for (int i = 0; i < STAT_HISTOGRAM_BINS / 2; ++i)
+            bins[i] = 0;
+        origin -= width * STAT_HISTOGRAM_BINS;
+        width *= 2;
+    }
+
+    const int bin = std::min(STAT_HISTOGRAM_BINS - 1,
+                             (int) ((value - origin) / width));
+    ++bins[bin];
+}
+
+/**
+ * Return the sample standard deviation, or 0 for fewer than two samples.
+**/
+double stat_accumulator::stddev () const
+{
+    return (n > 1 ? sqrt(m2 / (n - 1)) : 0);
+}
+
+/**
+ * Return an estimate of a percentile, from the histogram: the value below
+ * which fraction p of the samples lie, interpolated within its bin.
+ *
+ * @param p From 0 to 1.
+**/
+double stat_accumulator::percentile (double p) const
+{
+    if (!n)
+        return (0);
+
+    const double wanted = p * n;
+    double seen = 0;
+    for (int i = 0; i < STAT_HISTOGRAM_BINS; ++i)
+    {
+        if (bins[i] && seen + bins[i] >= wanted)
+        {
+            const double value =
+                origin + width * (i + (wanted - seen) / bins[i]);
+            return (std::max(low, std::min(high, value)));
+        }
+        seen += bins[i];
+    }
+    return (high);
+}
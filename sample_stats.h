@@ -0,0 +1,40 @@
+/**
+ * sample_stats.h
+**/
+
+#ifndef __SAMPLE_STATS_H__
+#define __SAMPLE_STATS_H__
+
+#include "AppHdr.h"
+
+// The number of bins in a stat_accumulator's histogram.
+#define STAT_HISTOGRAM_BINS 32
+
+// The distribution of a sampled number, kept in constant space: its mean and
+// variance, by Welford's method, and a histogram whose bins widen as needed
+// to cover every value seen.
+class stat_accumulator
+{
+public:
+    stat_accumulator ();
+
+    void add (double value);
+
+    int count () const { return n; }
+    double mean () const { return m; }
+    double stddev () const;
+    double min () const { return low; }
+    double max () const { return high; }
+    double percentile (double p) const;
+
+private:
+    int n;
+    double m, m2;
+    double low, high;
+
+    // Bin i holds values from origin + i * width up to the next bin.
+    double origin, width;
+    int bins[STAT_HISTOGRAM_BINS];
+};
+
+#endif
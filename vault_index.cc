@@ -0,0 +1,461 @@
+/**
+ * @file vault_index.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Build and use the vault index: the name and type of the monster that every
+ * vault monster spec makes, worked out ahead of time so that a lookup doesn't
+ * have to place every vault monster to find one.
+ *
+ * Specs that make the same monster, differing only in whitespace, tag order
+ * or tags that don't matter, are grouped so that only one of them is used.
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "enum.h"
+#include "stringutil.h"
+#include "vault_index.h"
+#include "vault_monster_data.h"
+#include "vault_monster_format.h"
+#include "vault_monsters.h"
+#include "version.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char *VAULT_INDEX_FILE = "vault_monster_index.bin";
+
+// Tags that make no difference to the monster a spec makes.
+static const char *IRRELEVANT_VAULT_TAGS[] = { "tile:" };
+
+/**
+ * Return a spec with its whitespace normalised, its tags sorted, and tags
+ * that don't matter dropped, so that specs making the same monster compare
+ * equal.
+ *
+ * @param spec The specification.
+**/
+std::string canonical_vault_spec (const std::string &spec)
+{
+    std::vector<std::string> words = split_string(" ", spec, true, false);
+    std::vector<std::string> base, tags;
+
+    for (unsigned int i = 0; i < words.size(); ++i)
+    {
+        // Monster names are made of plain words; anything after the first
+        // tag (name:foo, n_rpl) is a tag too.
+        if (tags.empty() && words[i].find_first_of(":_") == std::string::npos)
+        {
+            base.push_back(words[i]);
+            continue;
+        }
+
+        bool irrelevant = false;
+        for (unsigned int j = 0; j < ARRAYSZ(IRRELEVANT_VAULT_TAGS); ++j)
+            if (starts_with(words[i], IRRELEVANT_VAULT_TAGS[j]))
+                irrelevant = true;
+        if (!irrelevant)
+            tags.push_back(words[i]);
+    }
+
+    std::sort(tags.begin(), tags.end());
+    base.insert(base.end(), tags.begin(), tags.end());
+    return comma_separated_line(base.begin(), base.end(), " ", " ");
+}
+
+/**
+ * Return where the vault index lives: next to the binary, since that is
+ * where install-trunk puts it.
+**/
+static std::string vault_index_path ()
+{
+    char buf[4096];
+    const ssize_t len = readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+    if (len <= 0)
+        return VAULT_INDEX_FILE;
+    buf[len] = 0;
+
+    std::string dir = buf;
+    dir.erase(dir.rfind('/') + 1);
+    return dir + VAULT_INDEX_FILE;
+}
+
+// Where everything in a mapped vault index is.
+struct vault_index_tables
+{
+    const vault_index_header *header;
+    const uint32_t           *name_offsets;
+    const uint32_t           *name_groups;
+    const vault_index_entry  *groups;
+    const uint32_t           *members;
+    const vault_index_type   *types;
+    const uint32_t           *type_groups;
+
+    const char *name (int index) const
+    {
+        return reinterpret_cast<const char *>(header) + name_offsets[index];
+    }
+};
+
+static size_t vault_index_size (const vault_index_header *header)
+{
+    return sizeof(*header)
+           + (2 * header->name_count + 1 + header->member_count
+              + header->type_member_count) * sizeof(uint32_t)
+           + header->group_count * sizeof(vault_index_entry)
+           + header->type_count * sizeof(vault_index_type);
+}
+
+/**
+ * Return why a vault index can't be used, or an empty string if it can.
+ *
+ * @param header The start of the index file.
+ * @param size   The size of the index file.
+**/
+static std::string vault_index_problem (const vault_index_header *header,
+                                        size_t size)
+{
+    if (size < sizeof(*header)
+        || memcmp(header->magic, VAULT_INDEX_MAGIC, sizeof(header->magic))
+        || header->version != VAULT_INDEX_VERSION
+        || size < vault_index_size(header))
+    {
+        return ("it is not a valid vault index");
+    }
+
+    if (strncmp(header->crawl_version, Version::Long,
+                sizeof(header->crawl_version)))
+    {
+        return make_stringf("it was built for crawl %.*s, not %s",
+                            (int) sizeof(header->crawl_version),
+                            header->crawl_version, Version::Long);
+    }
+
+    if (header->data_hash != vault_monster_data_hash())
+        return ("the vault monster data has changed since it was built");
+
+    return ("");
+}
+
+/**
+ * Return why a vault index file is stale, or an empty string if it is up to
+ * date.
+ *
+ * @param filename The index file.
+**/
+std::string vault_index_staleness (const std::string &filename)
+{
+    FILE *in = fopen(filename.c_str(), "rb");
+    if (!in)
+        return ("it doesn't exist");
+
+    vault_index_header header;
+    struct stat st;
+    const bool read = fread(&header, sizeof(header), 1, in) == 1
+                      && !fstat(fileno(in), &st);
+    fclose(in);
+    if (!read)
+        return ("it is not a valid vault index");
+
+    return vault_index_problem(&header, st.st_size);
+}
+
+/**
+ * Map the vault index into memory.
+ *
+ * @return The index, with a null header if there is none, or it is stale;
+ *         vault monsters are then found the slow way.
+**/
+static const vault_index_tables &vault_index ()
+{
+    static vault_index_tables index;
+    static bool loaded = false;
+
+    if (loaded)
+        return (index);
+    loaded = true;
+    index.header = 0;
+
+    const std::string path = vault_index_path();
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return (index);
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (!fstat(fd, &st) && st.st_size >= (off_t) sizeof(vault_index_header))
+        map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return (index);
+
+    const vault_index_header *header =
+        static_cast<const vault_index_header *>(map);
+
+    const std::string problem = vault_index_problem(header, st.st_size);
+    if (!problem.empty())
+    {
+        fprintf(stderr, "Ignoring vault index %s: %s.\n", path.c_str(),
+                problem.c_str());
+        munmap(map, st.st_size);
+        return (index);
+    }
+
+    index.header       = header;
+    index.name_offsets = reinterpret_cast<const uint32_t *>(header + 1);
+    index.name_groups  = index.name_offsets + header->name_count;
+    index.groups       = reinterpret_cast<const vault_index_entry *>(
+                             index.name_groups + header->name_count + 1);
+    index.members      = reinterpret_cast<const uint32_t *>(
+                             index.groups + header->group_count);
+    index.types        = reinterpret_cast<const vault_index_type *>(
+                             index.members + header->member_count);
+    index.type_groups  = reinterpret_cast<const uint32_t *>(
+                             index.types + header->type_count);
+    return (index);
+}
+
+/**
+ * Return the number of monster names in the vault index, or 0 if there is no
+ * usable index.
+**/
+int vault_index_name_count ()
+{
+    const vault_index_tables &index = vault_index();
+    return index.header ? index.header->name_count : 0;
+}
+
+/**
+ * Return a monster name from the vault index, as a key from vault_name_key().
+ *
+ * @param index The index of the name, from 0 to vault_index_name_count() - 1;
+ *              names are sorted.
+**/
+const char *vault_index_name (int index)
+{
+    const vault_index_tables &tables = vault_index();
+    ASSERT(tables.header && index >= 0
+           && index < (int) tables.header->name_count);
+    return tables.name(index);
+}
+
+static vault_index_group vault_index_group_at (const vault_index_tables &index,
+                                               int name, int group)
+{
+    const vault_index_entry &entry = index.groups[group];
+
+    vault_index_group result;
+    result.name = index.name(name);
+    result.spec = entry.spec;
+    for (uint32_t i = 0; i < entry.member_count; ++i)
+        result.members.push_back(index.members[entry.first_member + i]);
+    return (result);
+}
+
+/**
+ * Find the vault monster specs that make a monster.
+ *
+ * @param name_key The monster's name; only its vault_name_key() matters.
+ * @return The groups of specs that make it; empty if there are none, or
+ *         if there is no usable vault index.
+**/
+std::vector<vault_index_group> vault_index_find (const std::string &name_key)
+{
+    std::vector<vault_index_group> result;
+
+    const vault_index_tables &index = vault_index();
+    if (!index.header)
+        return (result);
+
+    int low = 0, high = index.header->name_count;
+    while (low < high)
+    {
+        const int mid = (low + high) / 2;
+        if (vault_name_compare(index.name(mid), name_key.c_str()) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (low == (int) index.header->name_count
+        || vault_name_compare(index.name(low), name_key.c_str()))
+    {
+        return (result);
+    }
+
+    for (uint32_t i = index.name_groups[low]; i < index.name_groups[low + 1];
+         ++i)
+    {
+        result.push_back(vault_index_group_at(index, low, i));
+    }
+    return (result);
+}
+
+/**
+ * Find the vault monster specs that customise a kind of monster.
+ *
+ * @param type The monster_type.
+ * @return The groups of specs that make a monster of that type, in order of
+ *         name; empty if there are none, or if there is no usable vault
+ *         index.
+**/
+std::vector<vault_index_group> vault_index_for_type (int type)
+{
+    std::vector<vault_index_group> result;
+
+    const vault_index_tables &index = vault_index();
+    if (!index.header)
+        return (result);
+
+    const vault_index_type *types_end = index.types + index.header->type_count;
+    const vault_index_type *found = std::lower_bound(
+        index.types, types_end, (uint32_t) type,
+        [](const vault_index_type &entry, uint32_t t) { return entry.type < t; });
+    if (found == types_end || found->type != (uint32_t) type)
+        return (result);
+
+    const uint32_t *name_groups_end =
+        index.name_groups + index.header->name_count + 1;
+    for (uint32_t i = 0; i < found->group_count; ++i)
+    {
+        const uint32_t group = index.type_groups[found->first_group + i];
+        // The name whose groups include this one.
+        const int name = std::upper_bound(index.name_groups, name_groups_end,
+                                          group)
+                         - index.name_groups - 1;
+        result.push_back(vault_index_group_at(index, name, group));
+    }
+    return (result);
+}
+
+static void append_uint32 (std::string &output, uint32_t value)
+{
+    output.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+/**
+ * Work out what every vault monster spec is called, and write the vault
+ * index.
+ *
+ * @param filename Where to write the index.
+ * @return The number of names indexed, or -1 on error.
+**/
+int build_vault_index (const std::string &filename)
+{
+    std::vector<std::string> specs;
+    for (int i = 0, count = vault_monster_count(); i < count; ++i)
+        specs.push_back(vault_monster_spec(i));
+
+    // Only the names are needed; validate-vaults is what finds the specs
+    // that can't be placed.
+    const std::vector<vault_spec_result> results =
+        check_vault_specs(specs, false);
+    if (results.size() != specs.size())
+        return (-1);
+
+    // name -> canonical spec -> specs, in order. As the specs are sorted,
+    // the first of each group is the one used for all of them. Names that
+    // have the same key are the same name.
+    typedef std::map<std::string, std::vector<int> > spec_groups;
+    typedef std::map<std::string, spec_groups, vault_name_less> name_groups_map;
+    name_groups_map names;
+    for (unsigned int i = 0; i < specs.size(); ++i)
+    {
+        if (!results[i].error.empty())
+            continue;
+        names[results[i].name][canonical_vault_spec(specs[i])].push_back(i);
+    }
+
+    std::string name_offsets, name_groups, groups, members, strings;
+    uint32_t ngroups = 0, nmembers = 0;
+    // monster_type -> groups that make one.
+    std::map<int, std::vector<uint32_t> > type_groups;
+    for (name_groups_map::const_iterator i = names.begin();
+         i != names.end(); ++i)
+    {
+        append_uint32(name_groups, ngroups);
+        for (spec_groups::const_iterator j = i->second.begin();
+             j != i->second.end(); ++j)
+        {
+            append_uint32(groups, j->second[0]);
+            append_uint32(groups, nmembers);
+            append_uint32(groups, j->second.size());
+            for (unsigned int k = 0; k < j->second.size(); ++k)
+                append_uint32(members, j->second[k]);
+            nmembers += j->second.size();
+
+            const int type = results[j->second[0]].type;
+            if (type >= 0 && type < NUM_MONSTERS)
+                type_groups[type].push_back(ngroups);
+            ++ngroups;
+        }
+    }
+    append_uint32(name_groups, ngroups);
+
+    std::string types, type_members;
+    uint32_t ntype_members = 0;
+    for (std::map<int, std::vector<uint32_t> >::const_iterator i =
+             type_groups.begin(); i != type_groups.end(); ++i)
+    {
+        append_uint32(types, i->first);
+        append_uint32(types, ntype_members);
+        append_uint32(types, i->second.size());
+        for (unsigned int j = 0; j < i->second.size(); ++j)
+            append_uint32(type_members, i->second[j]);
+        ntype_members += i->second.size();
+    }
+
+    vault_index_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, VAULT_INDEX_MAGIC, sizeof(header.magic));
+    header.version      = VAULT_INDEX_VERSION;
+    strncpy(header.crawl_version, Version::Long,
+            sizeof(header.crawl_version) - 1);
+    header.data_hash    = vault_monster_data_hash();
+    header.name_count   = names.size();
+    header.group_count  = ngroups;
+    header.member_count = nmembers;
+    header.type_count   = type_groups.size();
+    header.type_member_count = ntype_members;
+
+    const size_t base = vault_index_size(&header);
+    for (name_groups_map::const_iterator i = names.begin();
+         i != names.end(); ++i)
+    {
+        append_uint32(name_offsets, base + strings.size());
+        strings += vault_name_key(i->first);
+        strings += '\0';
+    }
+
+    std::string output(reinterpret_cast<const char *>(&header), sizeof(header));
+    output += name_offsets + name_groups + groups + members + types
+              + type_members + strings;
+
+    // Write a new file and move it into place, so that a running
+    // monster-trunk never sees half an index.
+    const std::string tmp = filename + ".tmp";
+    FILE *out = fopen(tmp.c_str(), "wb");
+    if (!out || fwrite(output.data(), 1, output.size(), out) != output.size())
+    {
+        fprintf(stderr, "Unable to write %s\n", tmp.c_str());
+        if (out)
+            fclose(out);
+        return (-1);
+    }
+    fclose(out);
+    if (rename(tmp.c_str(), filename.c_str()))
+    {
+        fprintf(stderr, "Unable to write %s\n", filename.c_str());
+        return (-1);
+    }
+
+    printf("Indexed %u vault monster names from %u specs in %u groups.\n",
+           (unsigned int) names.size(), (unsigned int) specs.size(),
+           (unsigned int) ngroups);
+    return (names.size());
+}
@@ -0,0 +1,27 @@
+/**
+ * vault_index.h
+**/
+
+#ifndef __VAULT_INDEX_H__
+#define __VAULT_INDEX_H__
+
+#include "AppHdr.h"
+
+// Vault monster specs that make the same monster, differing only in
+// whitespace, tag order or tags that don't matter.
+struct vault_index_group
+{
+    std::string name;          // The name key of the monster they make.
+    int spec;                  // The spec to use for all of them.
+    std::vector<int> members;  // All of them, including spec.
+};
+
+std::string canonical_vault_spec (const std::string &spec);
+int vault_index_name_count ();
+const char *vault_index_name (int index);
+std::vector<vault_index_group> vault_index_find (const std::string &name_key);
+std::vector<vault_index_group> vault_index_for_type (int type);
+std::string vault_index_staleness (const std::string &filename);
+int build_vault_index (const std::string &filename);
+
+#endif
@@ -0,0 +1,431 @@
+/**
+ * @file vault_lua.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Run the Lua in every vault and capture the monster specs it emits, so that
+ * monsters that vault Lua puts together at runtime can be found too;
+ * des-scanner only sees the specs written out in the .des files.
+ *
+ * monster-trunk doesn't link the map compiler, so the Lua chunks are pulled
+ * out of each .des file here: the chunks outside any map, which are run
+ * before each map's own, and each map's main and prelude chunks. Each map's
+ * Lua is run several times, since it usually picks its monsters at random,
+ * in a sandbox environment on dlua where mons() and kmons() record their
+ * specs and every other map directive does nothing. Each run is seeded from
+ * the .des file's path and the run's number, so that capturing the same
+ * .des files again gives the same specs. Each .des file is run in
+ * a worker process, and every run has an instruction budget, so a vault
+ * that crashes or never finishes loses only its own file.
+ *
+ * The specs are written one per line, with the file, line and map they came
+ * from, for des-scanner to merge into the vault monster data. The file is
+ * stamped with the hash of the .des files, so it can be recaptured when they
+ * change.
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "artifacts.h"
+#include "dlua.h"
+#include "initfile.h"
+#include "random.h"
+#include "stringutil.h"
+#include "vault_lua.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <zlib.h>
+#include <fstream>
+#include <set>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern CLua dlua;
+
+// How many times to run each map's Lua, to see the monsters it picks.
+static const int VAULT_LUA_RUNS = 8;
+
+// How many thousand Lua instructions one run may take.
+static const int VAULT_LUA_BUDGET = 10000;
+
+// How many seconds a worker may take over one .des file.
+static const int VAULT_LUA_FILE_TIMEOUT = 60;
+
+// Sets up vault_lua_sandbox(), which returns a fresh environment to run a
+// map's Lua in. mons() and kmons(), and the dgn.mons() and dgn.kmons() they
+// stand for, add their specs to vault_lua_specs; every other map directive
+// does nothing; anything else is looked up as usual.
+static const char *VAULT_LUA_SANDBOX =
+"local function capture(kind)\n"
+"  return function (...)\n"
+"    for _, spec in ipairs({...}) do\n"
+"      if type(spec) == 'string' then\n"
+"        table.insert(vault_lua_specs, kind .. spec)\n"
+"      end\n"
+"    end\n"
+"  end\n"
+"end\n"
+"local capture_mons, capture_kmons = capture('MONS:'), capture('KMONS:')\n"
+"local function directive() end\n"
+"function vault_lua_sandbox()\n"
+"  vault_lua_specs = { }\n"
+"  local sandbox_dgn = setmetatable(\n"
+"    { mons = function (map, ...) capture_mons(...) end,\n"
+"      kmons = function (map, ...) capture_kmons(...) end },\n"
+"    { __index = dgn })\n"
+"  local env = { mons = capture_mons, kmons = capture_kmons,\n"
+"                dgn = sandbox_dgn }\n"
+"  env._G = env\n"
+"  return setmetatable(env, { __index = function (t, k)\n"
+"    if type(dgn[k]) == 'function' then\n"
+"      return directive\n"
+"    end\n"
+"    return _G[k]\n"
+"  end })\n"
+"end\n";
+
+// Where the Lua for one map was found, and the Lua itself.
+struct des_lua_map
+{
+    des_lua_map (const std::string &n, int l) : name(n), line(l) { }
+
+    std::string name;
+    int line;
+    std::string code;
+};
+
+static int vault_lua_budget;
+
+static void vault_lua_budget_hook (lua_State *ls, lua_Debug *)
+{
+    if (--vault_lua_budget < 0)
+        luaL_error(ls, "vault Lua ran for too long");
+}
+
+/**
+ * Add the path of every .des file under a folder, relative to the top-level
+ * des folder, to a list.
+**/
+static void find_des_files (const std::string &folder,
+                            const std::string &relative,
+                            std::vector<std::string> &files)
+{
+    DIR *dir = opendir(folder.c_str());
+    if (!dir)
+        return;
+
+    while (dirent *entry = readdir(dir))
+    {
+        const std::string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+
+        const std::string path = folder + "/" + name;
+        const std::string rel = relative.empty() ? name : relative + "/" + name;
+
+        struct stat st;
+        if (lstat(path.c_str(), &st))
+            continue;
+
+        if (S_ISDIR(st.st_mode))
+            find_des_files(path, rel, files);
+        else if (S_ISREG(st.st_mode) && ends_with(name, ".des"))
+            files.push_back(rel);
+    }
+
+    closedir(dir);
+}
+
+/**
+ * If a line opens a "{{" chunk, say what kind of chunk it is ("" for a main
+ * chunk), and set rest to whatever follows the "{{" on the line.
+**/
+static bool chunk_opener (const std::string &trimmed, std::string &kind,
+                          std::string &rest)
+{
+    const std::string::size_type pos = trimmed.find("{{");
+    if (pos == std::string::npos)
+        return (false);
+
+    kind = trimmed_string(trimmed.substr(0, pos));
+    for (unsigned int i = 0; i < kind.size(); ++i)
+        if (!isalpha(kind[i]))
+            return (false);
+    rest = trimmed.substr(pos + 2);
+    return (true);
+}
+
+/**
+ * If a line closes a chunk, by ending with "}}", set code to the Lua before
+ * the "}}".
+**/
+static bool chunk_closer (const std::string &line, std::string &code)
+{
+    const std::string trimmed = trimmed_string(line);
+    if (!ends_with(trimmed, "}}"))
+        return (false);
+    code = trimmed.substr(0, trimmed.size() - 2);
+    return (true);
+}
+
+/**
+ * Pull the Lua out of a .des file: "{{ ... }}" chunks, unless they are
+ * validate, veto or epilogue chunks, and ": ..." lines. A chunk may open
+ * and close on the same line, and may have code before its "}}".
+ *
+ * @param path      The path of the file.
+ * @param file_code Set to the Lua outside any map.
+ * @param maps      Set to each map and its own Lua.
+**/
+static void read_des_lua (const std::string &path, std::string &file_code,
+                          std::vector<des_lua_map> &maps)
+{
+    std::ifstream in(path.c_str());
+    std::string line;
+    int line_number = 0;
+    bool in_map_body = false, in_chunk = false, run_chunk = false;
+    int current = -1;
+    std::string kind, rest, last;
+
+    while (std::getline(in, line))
+    {
+        ++line_number;
+        const std::string trimmed = trimmed_string(line);
+        std::string &code = current < 0 ? file_code : maps[current].code;
+
+        if (in_chunk)
+        {
+            if (chunk_closer(line, last))
+            {
+                in_chunk = false;
+                if (run_chunk)
+                    code += last + "\n";
+            }
+            else if (run_chunk)
+                code += line + "\n";
+        }
+        else if (in_map_body)
+        {
+            if (trimmed == "ENDMAP")
+            {
+                in_map_body = false;
+                current = -1;
+            }
+        }
+        else if (starts_with(trimmed, "NAME:"))
+        {
+            maps.push_back(des_lua_map(trimmed_string(trimmed.substr(5)),
+                                       line_number));
+            current = maps.size() - 1;
+        }
+        else if (trimmed == "MAP")
+            in_map_body = true;
+        else if (chunk_opener(trimmed, kind, rest))
+        {
+            run_chunk = kind.empty() || kind == "lua" || kind == "prelude";
+            in_chunk = !chunk_closer(rest, last);
+            if (run_chunk)
+                code += (in_chunk ? rest : last) + "\n";
+        }
+        else if (starts_with(trimmed, ":"))
+            code += trimmed.substr(1) + "\n";
+    }
+}
+
+/**
+ * Run a map's Lua VAULT_LUA_RUNS times in the sandbox, and add the specs it
+ * emitted to a set. Specs emitted before an error are kept: the sandbox is
+ * only an approximation of a real level, so the error may be its fault.
+ * Each run is seeded with seed plus its number.
+**/
+static void run_vault_lua (lua_State *ls, const std::string &code,
+                           const std::string &chunk_name, uint32_t seed,
+                           std::set<std::string> &specs)
+{
+    const int top = lua_gettop(ls);
+    for (int run = 0; run < VAULT_LUA_RUNS; ++run)
+    {
+        // A chunk that doesn't compile won't compile next time either.
+        if (luaL_loadbuffer(ls, code.data(), code.size(), chunk_name.c_str()))
+        {
+            fprintf(stderr, "Vault Lua for %s didn't load: %s\n",
+                    chunk_name.c_str(), lua_tostring(ls, -1));
+            break;
+        }
+
+        lua_getglobal(ls, "vault_lua_sandbox");
+        if (lua_pcall(ls, 0, 1, 0))
+        {
+            fprintf(stderr, "Vault Lua sandbox failed for %s: %s\n",
+                    chunk_name.c_str(), lua_tostring(ls, -1));
+            break;
+        }
+        lua_setfenv(ls, -2);
+
+        seed_rng(seed + run);
+        vault_lua_budget = VAULT_LUA_BUDGET;
+        lua_pcall(ls, 0, 0, 0);
+        lua_settop(ls, top);
+
+        lua_getglobal(ls, "vault_lua_specs");
+        if (lua_istable(ls, -1))
+        {
+            for (int i = 1; ; ++i)
+            {
+                lua_rawgeti(ls, -1, i);
+                if (!lua_isstring(ls, -1))
+                    break;
+                specs.insert(lua_tostring(ls, -1));
+                lua_pop(ls, 1);
+            }
+        }
+        lua_settop(ls, top);
+    }
+    lua_settop(ls, top);
+}
+
+/**
+ * Run the Lua for every map in a .des file, and write one line per spec to
+ * fd: the file, line, map and spec, separated by tabs.
+**/
+static void capture_des_file (const std::string &file, const std::string &path,
+                              int fd)
+{
+    FILE *out = fdopen(fd, "w");
+
+    std::string file_code;
+    std::vector<des_lua_map> maps;
+    read_des_lua(path, file_code, maps);
+
+    lua_State *ls = dlua.state();
+    lua_sethook(ls, vault_lua_budget_hook, LUA_MASKCOUNT, 1000);
+
+    // Seeded from the path relative to the des folder, so that it doesn't
+    // depend on where the source is checked out.
+    const uint32_t seed =
+        crc32(crc32(0L, Z_NULL, 0),
+              reinterpret_cast<const Bytef *>(file.c_str()), file.size());
+
+    for (unsigned int i = 0; i < maps.size(); ++i)
+    {
+        if (maps[i].code.empty())
+            continue;
+
+        std::set<std::string> specs;
+        run_vault_lua(ls, file_code + maps[i].code,
+                      file + ":" + maps[i].name, seed, specs);
+        for (std::set<std::string>::const_iterator s = specs.begin();
+             s != specs.end(); ++s)
+        {
+            fprintf(out, "%s\t%d\t%s\t%s\n", file.c_str(), maps[i].line,
+                    maps[i].name.c_str(),
+                    replace_all_of(*s, "\t\n", " ").c_str());
+        }
+        // Flush every map, so that a crash only loses the map that caused it.
+        fflush(out);
+    }
+
+    lua_sethook(ls, NULL, 0, 0);
+    fclose(out);
+}
+
+/**
+ * Run the Lua of every vault, and write the monster specs it emits to a file
+ * for des-scanner.
+ *
+ * @param filename  The file to write the specs to.
+ * @param crawl_dir The crawl source folder, with dat/des and dat/dlua in it.
+ * @return The number of specs written, or -1 on error.
+**/
+int capture_vault_lua_specs (const std::string &filename,
+                             const std::string &crawl_dir)
+{
+    SysEnv.crawl_dir = crawl_dir + "/";
+    init_dungeon_lua();
+    if (dlua.execstring(VAULT_LUA_SANDBOX, "vault_lua"))
+    {
+        fprintf(stderr, "Unable to set up the vault Lua sandbox: %s\n",
+                dlua.error.c_str());
+        return (-1);
+    }
+
+    const std::string des_folder = crawl_dir + "/dat/des";
+    std::vector<std::string> files;
+    find_des_files(des_folder, "", files);
+    if (files.empty())
+    {
+        fprintf(stderr, "No .des files in %s\n", des_folder.c_str());
+        return (-1);
+    }
+    std::sort(files.begin(), files.end());
+
+    std::set<std::string> lines;
+    fflush(stdout);
+    for (unsigned int i = 0; i < files.size(); ++i)
+    {
+        int pipefd[2];
+        if (pipe(pipefd))
+            return (-1);
+
+        const pid_t pid = fork();
+        if (pid == 0)
+        {
+            close(pipefd[0]);
+            alarm(VAULT_LUA_FILE_TIMEOUT);
+            capture_des_file(files[i], des_folder + "/" + files[i], pipefd[1]);
+            _exit(0);
+        }
+
+        close(pipefd[1]);
+        if (pid < 0)
+        {
+            close(pipefd[0]);
+            fprintf(stderr, "Unable to start a vault Lua worker.\n");
+            return (-1);
+        }
+
+        FILE *in = fdopen(pipefd[0], "r");
+        char *buf = NULL;
+        size_t size = 0;
+        ssize_t len;
+        while ((len = getline(&buf, &size, in)) > 0)
+            lines.insert(std::string(buf, buf[len - 1] == '\n' ? len - 1 : len));
+        free(buf);
+        fclose(in);
+
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status))
+        {
+            printf("Vault Lua in %s crashed; the rest of its maps were "
+                   "skipped.\n", files[i].c_str());
+        }
+    }
+
+    FILE *out = fopen(filename.c_str(), "w");
+    if (!out)
+    {
+        fprintf(stderr, "Unable to write %s\n", filename.c_str());
+        return (-1);
+    }
+    fprintf(out, ARTIFACT_STAMP_PREFIX "%s\n",
+            artifact_stamp(ARTIFACT_FROM_DES).c_str());
+    fprintf(out, "# Vault monster specs emitted by vault Lua, from "
+                 "--capture-vault-lua.\n"
+                 "# des-scanner adds the named ones to the vault monster "
+                 "data.\n");
+    for (std::set<std::string>::const_iterator l = lines.begin();
+         l != lines.end(); ++l)
+    {
+        fprintf(out, "%s\n", l->c_str());
+    }
+    fclose(out);
+
+    printf("Captured %u vault Lua monster specs from %u .des files; written "
+           "to %s\n", (unsigned int) lines.size(), (unsigned int) files.size(),
+           filename.c_str());
+    return (lines.size());
+}
@@ -0,0 +1,13 @@
+/**
+ * vault_lua.h
+**/
+
+#ifndef __VAULT_LUA_H__
+#define __VAULT_LUA_H__
+
+#include "AppHdr.h"
+
+int capture_vault_lua_specs (const std::string &filename,
+                             const std::string &crawl_dir);
+
+#endif
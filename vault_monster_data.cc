@@ -0,0 +1,171 @@
+/**
+ * @file vault_monster_data.cc
+ *
+ * @section DESCRIPTION
+ *
+ * Access the vault-defined monster specifications that des-scanner packs
+ * into vault_monster_data.bin, and that vault_monster_blob.S links into the
+ * binary. The specifications are used in place, so there is nothing to set
+ * up at startup.
+ *
+**/
+
+#include "AppHdr.h"
+
+#include "vault_monster_data.h"
+#include "vault_monster_format.h"
+#include "version.h"
+
+#include <zlib.h>
+
+extern "C" const char vault_monster_blob[];
+extern "C" const char vault_monster_blob_end[];
+
+/**
+ * Return the header of the linked-in vault data, or 0 if it is unusable. Data
+ * scanned from another crawl version is still used, since there is nothing
+ * better, but with a warning.
+**/
+static const vault_data_header *vault_data()
+{
+    static const vault_data_header *header = 0;
+    static bool checked = false;
+
+    if (checked)
+        return header;
+    checked = true;
+
+    const size_t size = vault_monster_blob_end - vault_monster_blob;
+    const vault_data_header *data =
+        reinterpret_cast<const vault_data_header *>(vault_monster_blob);
+
+    if (size < sizeof(*data)
+        || memcmp(data->magic, VAULT_DATA_MAGIC, sizeof(data->magic))
+        || data->version != VAULT_DATA_VERSION
+        || size < sizeof(*data)
+                  + (2 * data->count + 1 + data->string_count) * sizeof(uint32_t)
+                  + data->source_count * sizeof(vault_spec_source))
+    {
+        fprintf(stderr, "Ignoring invalid vault monster data.\n");
+        return 0;
+    }
+
+    if (strncmp(data->crawl_version, Version::Long,
+                sizeof(data->crawl_version)))
+    {
+        fprintf(stderr, "Vault monster data is from crawl %.*s, not %s; "
+                "vault monsters may be out of date.\n",
+                (int) sizeof(data->crawl_version), data->crawl_version,
+                Version::Long);
+    }
+
+    header = data;
+    return header;
+}
+
+/**
+ * Return the number of vault-defined monster specifications.
+**/
+int vault_monster_count ()
+{
+    const vault_data_header *header = vault_data();
+    return header ? header->count : 0;
+}
+
+/**
+ * Return a vault-defined monster specification.
+ *
+ * @param index The index of the specification, from 0 to
+ *              vault_monster_count() - 1.
+ * @return The specification, which lives as long as the program.
+**/
+const char *vault_monster_spec (int index)
+{
+    const vault_data_header *header = vault_data();
+    ASSERT(header && index >= 0 && index < (int) header->count);
+
+    const uint32_t *offsets = reinterpret_cast<const uint32_t *>(header + 1);
+    return vault_monster_blob + offsets[index];
+}
+
+/**
+ * Find a vault-defined monster specification.
+ *
+ * @param spec The specification, exactly as vault_monster_spec() returns it.
+ * @return Its index, or -1 if there is no such specification.
+**/
+int vault_monster_spec_index (const std::string &spec)
+{
+    // The specifications are sorted, by des-scanner.
+    int low = 0, high = vault_monster_count();
+    while (low < high)
+    {
+        const int mid = (low + high) / 2;
+        if (strcmp(vault_monster_spec(mid), spec.c_str()) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return (low < vault_monster_count() && spec == vault_monster_spec(low)
+            ? low : -1);
+}
+
+/**
+ * Return every .des file, map and line that a vault-defined monster
+ * specification was found at.
+ *
+ * @param index The index of the specification.
+**/
+std::vector<vault_monster_source> vault_monster_sources (int index)
+{
+    const vault_data_header *header = vault_data();
+    ASSERT(header && index >= 0 && index < (int) header->count);
+
+    const uint32_t *spec_sources =
+        reinterpret_cast<const uint32_t *>(header + 1) + header->count;
+    const vault_spec_source *sources =
+        reinterpret_cast<const vault_spec_source *>(
+            spec_sources + header->count + 1);
+    const uint32_t *string_offsets =
+        reinterpret_cast<const uint32_t *>(sources + header->source_count);
+
+    std::vector<vault_monster_source> result;
+    for (uint32_t i = spec_sources[index]; i < spec_sources[index + 1]; ++i)
+    {
+        vault_monster_source source;
+        source.file = vault_monster_blob + string_offsets[sources[i].file];
+        source.map  = vault_monster_blob + string_offsets[sources[i].map];
+        source.line = sources[i].line;
+        result.push_back(source);
+    }
+    return (result);
+}
+
+/**
+ * Return a hash of the linked-in vault data, so that anything derived from
+ * it can tell whether it is still up to date.
+**/
+uint32_t vault_monster_data_hash ()
+{
+    static uint32_t hash = 0;
+    static bool hashed = false;
+
+    if (!hashed)
+    {
+        hash = crc32(crc32(0L, Z_NULL, 0),
+                     reinterpret_cast<const Bytef *>(vault_monster_blob),
+                     vault_monster_blob_end - vault_monster_blob);
+        hashed = true;
+    }
+    return (hash);
+}
+
+/**
+ * Return a hash of the .des files that the linked-in vault data was scanned
+ * from, or 0 if there is no usable data.
+**/
+uint32_t vault_monster_des_hash ()
+{
+    const vault_data_header *header = vault_data();
+    return header ? header->des_hash : 0;
+}
@@ -7,6 +7,19 @@
 
 #include "AppHdr.h"
 
-std::vector<std::string> get_vault_monsters ();
+// Where a vault monster specification was found.
+struct vault_monster_source
+{
+    const char *file;
+    const char *map;
+    int line;
+};
+
+int vault_monster_count ();
+const char *vault_monster_spec (int index);
+int vault_monster_spec_index (const std::string &spec);
+std::vector<vault_monster_source> vault_monster_sources (int index);
+uint32_t vault_monster_data_hash ();
+uint32_t vault_monster_des_hash ();
 
 #endif
@@ -0,0 +1,113 @@
+/**
+ * @file vault_monster_format.h
+ *
+ * @section DESCRIPTION
+ *
+ * The layout of vault_monster_data.bin, as written by des-scanner and read
+ * by vault_monster_data.cc. This header is shared by both, so it must not
+ * depend on anything from crawl.
+ *
+ * The file is a vault_data_header, followed by:
+ *
+ *   uint32_t          spec_offsets[count];
+ *   uint32_t          spec_sources[count + 1];
+ *   vault_spec_source sources[source_count];
+ *   uint32_t          string_offsets[string_count];
+ *
+ * and then the NUL-terminated strings. The specifications are sorted; the
+ * sources of specification i are sources[spec_sources[i]] up to
+ * sources[spec_sources[i + 1]]. The .des file and map names that sources
+ * refer to are interned as strings; lines are numbered from 1. Offsets
+ * are relative to the start of the header. All values are in the byte
+ * order of the machine that built the data. The header records the crawl
+ * version the .des files came from, and a hash of the .des files, so that
+ * stale data can be detected.
+ *
+ * The vault index, vault_monster_index.bin, is written by
+ * monster-trunk --build-vault-index and read by vault_index.cc. It is a
+ * vault_index_header, followed by:
+ *
+ *   uint32_t          name_offsets[name_count];
+ *   uint32_t          name_groups[name_count + 1];
+ *   vault_index_entry groups[group_count];
+ *   uint32_t          members[member_count];
+ *   vault_index_type  types[type_count];
+ *   uint32_t          type_groups[type_member_count];
+ *
+ * and then the NUL-terminated names. The names are the sorted keys of the
+ * monsters that vault specs make; the groups of name i are
+ * groups[name_groups[i]] up to groups[name_groups[i + 1]]. The types are
+ * sorted by monster_type, and list the groups that make a monster of each
+ * type. The header records the crawl version and the hash of the vault data
+ * that were indexed.
+ *
+**/
+
+#ifndef __VAULT_MONSTER_FORMAT_H__
+#define __VAULT_MONSTER_FORMAT_H__
+
+#include <stdint.h>
+
+// The space for a crawl version, with its terminating NUL.
+#define VAULT_CRAWL_VERSION_SIZE 64
+
+#define VAULT_DATA_MAGIC   "VMONDAT"
+// Bump this whenever the layout changes.
+#define VAULT_DATA_VERSION 4
+
+struct vault_data_header
+{
+    char     magic[8];
+    uint32_t version;
+    char     crawl_version[VAULT_CRAWL_VERSION_SIZE];
+    uint32_t des_hash;      // The hash of the .des files that were scanned.
+    uint32_t count;
+    uint32_t source_count;
+    uint32_t string_count;
+};
+
+// Where a specification was found: the file and map as indices of interned
+// strings, and the line of the file.
+struct vault_spec_source
+{
+    uint32_t file;
+    uint32_t map;
+    uint32_t line;
+};
+
+#define VAULT_INDEX_MAGIC   "VMONIDX"
+// Bump this whenever the layout changes.
+#define VAULT_INDEX_VERSION 3
+
+struct vault_index_header
+{
+    char     magic[8];
+    uint32_t version;
+    char     crawl_version[VAULT_CRAWL_VERSION_SIZE];
+    uint32_t data_hash;     // The hash of the vault data that was indexed.
+    uint32_t name_count;
+    uint32_t group_count;
+    uint32_t member_count;
+    uint32_t type_count;
+    uint32_t type_member_count;
+};
+
+// Specifications that make the same monster: the one to use, and all of
+// them, as members[first_member] up to members[first_member + member_count].
+struct vault_index_entry
+{
+    uint32_t spec;
+    uint32_t first_member;
+    uint32_t member_count;
+};
+
+// The groups that make a monster of a type, as type_groups[first_group] up
+// to type_groups[first_group + group_count].
+struct vault_index_type
+{
+    uint32_t type;
+    uint32_t first_group;
+    uint32_t group_count;
+};
+
+#endif
@@ -5,57 +5,220 @@
  *
  * @section DESCRIPTION
  *
- * Parse the data created by parse_des.py and stored in vault_monster_data.cc,
+ * Parse the data created by des-scanner and stored in vault_monster_data.bin,
  * and possibly return a monster spec if the provided name is actually the name
  * of a vault-defined monster.
  *
+ * Also check every vault monster spec, so that the ones crawl can't use can
+ * be left out of the data altogether.
+ *
 **/
 
 #include "AppHdr.h"
 
+#include "act-iter.h"
 #include "dungeon.h"
 #include "env.h"
 #include "externs.h"
 #include "mapdef.h"
 #include "message.h"
+#include "mon-util.h"
+#include "monster.h"
 #include "monster-main.h"
 #include "stringutil.h"
+#include "vault_index.h"
 #include "vault_monster_data.h"
+#include "vault_monsters.h"
+
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * Return the key that vault monster names are matched on: lowercase, without
+ * apostrophes, and then trimmed.
+ *
+ * @param name A monster name, either as requested or as generated.
+**/
+std::string vault_name_key (std::string name)
+{
+    lowercase(name);
+    name = replace_all_of(name, "'", "");
+    trim_string(name);
+    return (name);
+}
+
+static inline bool vault_name_space (char c)
+{
+    return (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+}
+
+// Whether a character at either end of a name is dropped from its key: the
+// key is trimmed after its apostrophes go, so both go from the ends.
+static inline bool vault_name_edge (char c)
+{
+    return (vault_name_space(c) || c == '\'');
+}
+
+/**
+ * Compare two monster names as strcmp would compare their vault_name_key()s,
+ * without making copies of either. Keys compare the same way, so a name can
+ * be compared with a key directly.
+ *
+ * @param a A monster name, or a key.
+ * @param b Another.
+ * @return Less than, equal to or greater than 0, as for strcmp.
+**/
+int vault_name_compare (const char *a, const char *b)
+{
+    while (vault_name_edge(*a))
+        ++a;
+    while (vault_name_edge(*b))
+        ++b;
+    const char *a_end = a + strlen(a), *b_end = b + strlen(b);
+    while (a_end > a && vault_name_edge(a_end[-1]))
+        --a_end;
+    while (b_end > b && vault_name_edge(b_end[-1]))
+        --b_end;
+
+    while (true)
+    {
+        while (a < a_end && *a == '\'')
+            ++a;
+        while (b < b_end && *b == '\'')
+            ++b;
+
+        const int ca = a < a_end ? (unsigned char) tolower(*a++) : 0;
+        const int cb = b < b_end ? (unsigned char) tolower(*b++) : 0;
+        if (ca != cb || !ca)
+            return (ca - cb);
+    }
+}
+
+/**
+ * Return whether the name of the monster a spec makes depends on anything
+ * that only placing it decides: a random type or base type, or the items
+ * and ghost that some monsters are named after.
+**/
+static bool vault_spec_name_needs_placement (const mons_spec &spec)
+{
+    const monster_type type = static_cast<monster_type>(spec.type);
+    if (type < 0 || type >= NUM_MONSTERS || invalid_monster_type(type))
+        return (true);
+
+    if (mons_is_ghost_demon(type) || mons_class_is_chimeric(type)
+        || type == MONS_DANCING_WEAPON || type == MONS_SPECTRAL_WEAPON)
+    {
+        return (true);
+    }
+
+    const monster_type base = static_cast<monster_type>(spec.monbase);
+    if (base != MONS_NO_MONSTER)
+        return (base < 0 || base >= NUM_MONSTERS || invalid_monster_type(base));
+
+    // Without a base type, these get a random one when placed.
+    return (mons_class_is_zombified(type)
+            || mons_genus(type) == MONS_DRACONIAN
+            || mons_genus(type) == MONS_DEMONSPAWN);
+}
+
+/**
+ * Work out the name of the monster that a spec makes, without placing it.
+ *
+ * The monster is set up the way dgn_place_monster would, but in a scratch
+ * slot of menv that is never put on the grid, and without its band or
+ * items.
+ *
+ * @param spec The parsed specification.
+ * @return The monster's name, or the empty string if only placing it would
+ *         tell.
+**/
+static std::string vault_spec_name (const mons_spec &spec)
+{
+    monster &scratch = menv[MAX_MONSTERS - 1];
+    if (vault_spec_name_needs_placement(spec) || scratch.alive())
+        return ("");
+
+    scratch.reset();
+    scratch.type         = static_cast<monster_type>(spec.type);
+    scratch.base_monster = static_cast<monster_type>(spec.monbase);
+    scratch.number       = spec.number;
+    scratch.mname        = spec.monname;
+    scratch.props        = spec.props;
+    define_monster(&scratch);
+    scratch.flags       |= spec.extra_monster_flags;
+
+    const std::string name = scratch.name(DESC_PLAIN, true);
+    scratch.reset();
+    return (name);
+}
 
 /**
  * Return a vault-defined monster spec.
  *
- * This function parses the contents of (the generated) vault_monster_data.cc
- * and attempts to return a specification. If there is an invalid specification,
- * no error will be recorded.
+ * This looks the name up in the vault index, if there is an up to date one;
+ * failing that, it parses the contents of (the generated)
+ * vault_monster_data.bin and attempts to return a specification. The index
+ * only records the name each spec made once, so with an index only specs
+ * whose names depend on placement are tried again. If there is an invalid
+ * specification, no error will be recorded.
  *
- * @param monster_name Monster being searched for.  
+ * @param monster_name Monster being searched for.
  * @return A mons_spec instance that either contains the relevant data, or
  *         nothing if not found.
  *
 **/
 mons_spec get_vault_monster (std::string monster_name, std::string *vault_spec)
 {
-    lowercase(monster_name);
-    trim_string(monster_name);
-
-    monster_name = replace_all_of(monster_name, "'", "");
-
-    std::vector<std::string> monsters = get_vault_monsters();
+    monster_name = vault_name_key(monster_name);
 
     mons_list mons;
     mons_spec no_monster;
 
-    std::vector<std::string>::iterator it;
+    const std::vector<vault_index_group> groups =
+        vault_index_find(monster_name);
+    if (!groups.empty())
+    {
+        const char *spec = vault_monster_spec(groups[0].spec);
+        if (mons.add_mons(spec, false).empty())
+        {
+            if (vault_spec)
+                *vault_spec = spec;
+            return (mons.get_monster(0));
+        }
+    }
+
+    // An up to date index knows the name of every spec whose name is fixed,
+    // so only those that could come out differently need trying again.
+    const bool indexed = vault_index_name_count() != 0;
+    const int count = vault_monster_count();
 
-    for (it = monsters.begin(); it != monsters.end(); ++it)
+    for (int i = 0; i < count; ++i)
     {
+        const char *spec = vault_monster_spec(i);
+
         mons.clear();
 
-        const std::string err = mons.add_mons(*it, false);
+        const std::string err = mons.add_mons(spec, false);
         if (err.empty())
         {
             mons_spec this_mons = mons.get_monster(0);
+            if (indexed && !vault_spec_name_needs_placement(this_mons))
+                continue;
+
+            const std::string name = vault_spec_name(this_mons);
+            if (!name.empty())
+            {
+                if (vault_name_compare(name.c_str(), monster_name.c_str()))
+                    continue;
+                if (vault_spec)
+                    *vault_spec = spec;
+                return (this_mons);
+            }
+
             int index = mi_create_monster(this_mons);
 
             if (index < 0 || index >= MAX_MONSTERS)
@@ -69,10 +232,11 @@ mons_spec get_vault_monster (std::string monster_name, std::string *vault_spec)
 
             if (mp)
             {
-                std::string name = replace_all_of(mp->name(DESC_PLAIN, true), "'","");
-                lowercase(name);
-                if (name == monster_name)
+                if (!vault_name_compare(mp->name(DESC_PLAIN, true).c_str(),
+                                        monster_name.c_str()))
+                {
                     this_spec = true;
+                }
             }
 
             mons_remove_from_grid(mp);
@@ -80,7 +244,7 @@ mons_spec get_vault_monster (std::string monster_name, std::string *vault_spec)
             if (this_spec)
             {
                 if (vault_spec)
-                    *vault_spec = *it;
+                    *vault_spec = spec;
                 return (this_mons);
             }
         }
@@ -91,3 +255,393 @@ mons_spec get_vault_monster (std::string monster_name, std::string *vault_spec)
 
     return (no_monster);
 }
+
+/**
+ * Place or name a vault monster spec the way get_vault_monster would, and
+ * then remove every monster and item that placing it created.
+ *
+ * @param spec  The specification to check.
+ * @param place Whether to place the monster even if its name is all that is
+ *              wanted and can be worked out without placing it.
+ * @return What became of the spec.
+**/
+static vault_spec_result check_vault_spec (const std::string &spec, bool place)
+{
+    vault_spec_result result;
+
+    mons_list mons;
+    result.error = mons.add_mons(spec, false);
+
+    if (result.error.empty() && !place)
+    {
+        result.name = vault_spec_name(mons.get_monster(0));
+        result.type = mons.get_monster(0).type;
+    }
+
+    if (result.error.empty() && result.name.empty())
+    {
+        const int index = mi_create_monster(mons.get_monster(0));
+        if (index < 0 || index >= MAX_MONSTERS)
+            result.error = "could not be placed";
+        else
+        {
+            result.name = menv[index].name(DESC_PLAIN, true);
+            result.type = menv[index].type;
+        }
+    }
+
+    for (monster_iterator mi; mi; ++mi)
+    {
+        mi->destroy_inventory();
+        mi->reset();
+    }
+    you.unique_creatures.reset();
+
+    return (result);
+}
+
+static std::string escape_spec_line (const std::string &line)
+{
+    return replace_all(replace_all(line, "\\", "\\\\"), "\n", "\\n");
+}
+
+static std::string unescape_spec_line (const std::string &line)
+{
+    std::string result;
+    for (std::string::size_type i = 0; i < line.size(); ++i)
+    {
+        if (line[i] == '\\' && i + 1 < line.size())
+        {
+            ++i;
+            result += line[i] == 'n' ? '\n' : line[i];
+        }
+        else
+            result += line[i];
+    }
+    return (result);
+}
+
+// How many seconds a worker may take over one spec before it is taken to
+// have hung.
+static const int VAULT_SPEC_TIMEOUT = 10;
+
+/**
+ * Check the specs from first to last, in steps of step, and write one line
+ * per spec to fd: its index, what is wrong with it if anything, and the type
+ * and name of the monster it made, separated by tabs. Each spec has
+ * VAULT_SPEC_TIMEOUT seconds before the alarm kills the worker.
+**/
+static void check_vault_spec_range (const std::vector<std::string> &specs,
+                                    bool place, int first, int step, int fd)
+{
+    FILE *out = fdopen(fd, "w");
+
+    for (int i = first; i < (int) specs.size(); i += step)
+    {
+        alarm(VAULT_SPEC_TIMEOUT);
+        const vault_spec_result result = check_vault_spec(specs[i], place);
+        fprintf(out, "%d\t%s\t%d\t%s\n", i,
+                replace_all_of(result.error, "\t\n", " ").c_str(),
+                result.type,
+                replace_all_of(result.name, "\t\n", " ").c_str());
+        // Flush every line, so that a crash only loses the spec that caused it.
+        fflush(out);
+    }
+
+    alarm(0);
+    fclose(out);
+}
+
+static pid_t fork_spec_checker (const std::vector<std::string> &specs,
+                                bool place, int first, int step, int *fd)
+{
+    int pipefd[2];
+    if (pipe(pipefd))
+        return (-1);
+
+    const pid_t pid = fork();
+    if (pid == 0)
+    {
+        close(pipefd[0]);
+        check_vault_spec_range(specs, place, first, step, pipefd[1]);
+        _exit(0);
+    }
+
+    close(pipefd[1]);
+    if (pid < 0)
+    {
+        close(pipefd[0]);
+        return (-1);
+    }
+
+    *fd = pipefd[0];
+    return (pid);
+}
+
+/**
+ * Parse and place every spec, splitting the work across one worker process
+ * per CPU. A worker that crashes, or hangs on a spec for longer than
+ * VAULT_SPEC_TIMEOUT, is restarted after the spec that killed it.
+ *
+ * @param specs The specifications to check.
+ * @param place Whether to place every monster; if not, monsters whose names
+ *              can be worked out without placing them are only named.
+ * @return What became of each spec, or an empty vector on error.
+**/
+std::vector<vault_spec_result> check_vault_specs (
+    const std::vector<std::string> &specs, bool place)
+{
+    const int nworkers =
+        std::max(1, std::min((int) sysconf(_SC_NPROCESSORS_ONLN),
+                             (int) specs.size()));
+
+    std::vector<vault_spec_result> results(specs.size());
+    std::vector<pid_t> pids(nworkers);
+    std::vector<int> fds(nworkers);
+
+    fflush(stdout);
+    for (int w = 0; w < nworkers; ++w)
+    {
+        pids[w] = fork_spec_checker(specs, place, w, nworkers, &fds[w]);
+        if (pids[w] < 0)
+        {
+            fprintf(stderr, "Unable to start a vault spec worker.\n");
+            return std::vector<vault_spec_result>();
+        }
+    }
+
+    for (int w = 0; w < nworkers; ++w)
+    {
+        int first = w;
+        while (true)
+        {
+            FILE *in = fdopen(fds[w], "r");
+            char buf[8192];
+            int last = first - nworkers;
+            while (fgets(buf, sizeof buf, in))
+            {
+                std::vector<std::string> fields =
+                    split_string("\t", buf, false, true);
+                if (fields.size() != 4)
+                    continue;
+                const int index = atoi(fields[0].c_str());
+                if (index < 0 || index >= (int) specs.size())
+                    continue;
+                if (!fields[3].empty()
+                    && fields[3][fields[3].size() - 1] == '\n')
+                {
+                    fields[3].erase(fields[3].size() - 1);
+                }
+                results[index].error = fields[1];
+                results[index].type  = atoi(fields[2].c_str());
+                results[index].name  = fields[3];
+                last = index;
+            }
+            fclose(in);
+            int status = 0;
+            waitpid(pids[w], &status, 0);
+
+            first = last + nworkers;
+            if (first >= (int) specs.size())
+                break;
+
+            const bool hung = WIFSIGNALED(status)
+                              && WTERMSIG(status) == SIGALRM;
+            if (hung)
+                results[first].error = place ? "hung while placing"
+                                             : "hung while naming";
+            else
+                results[first].error = place ? "crashed while placing"
+                                             : "crashed while naming";
+            first += nworkers;
+            if (first >= (int) specs.size())
+                break;
+
+            pids[w] = fork_spec_checker(specs, place, first, nworkers,
+                                        &fds[w]);
+            if (pids[w] < 0)
+            {
+                fprintf(stderr, "Unable to start a vault spec worker.\n");
+                return std::vector<vault_spec_result>();
+            }
+        }
+    }
+
+    return (results);
+}
+
+/**
+ * Check every vault monster spec, along with any that were pruned last time,
+ * by parsing and placing it.
+ *
+ * @param prune_file Where to write the specs that failed, one per line, for
+ *                   des-scanner to leave out of the vault data.
+ * @return The number of invalid specs, or -1 on error.
+**/
+int validate_vault_specs (const std::string &prune_file)
+{
+    std::vector<std::string> specs;
+    std::set<std::string> known;
+    for (int i = 0, count = vault_monster_count(); i < count; ++i)
+    {
+        specs.push_back(vault_monster_spec(i));
+        known.insert(specs.back());
+    }
+
+    // Specs that are already pruned aren't in the vault data any more, but
+    // they still need checking in case crawl has since learned to use them.
+    if (FILE *old = fopen(prune_file.c_str(), "r"))
+    {
+        char buf[4096];
+        while (fgets(buf, sizeof buf, old))
+        {
+            std::string line = buf;
+            if (!line.empty() && line[line.size() - 1] == '\n')
+                line.erase(line.size() - 1);
+            if (line.empty() || line[0] == '#')
+                continue;
+            line = unescape_spec_line(line);
+            if (known.insert(line).second)
+                specs.push_back(line);
+        }
+        fclose(old);
+    }
+
+    const std::vector<vault_spec_result> results = check_vault_specs(specs);
+    if (results.size() != specs.size())
+        return (-1);
+
+    FILE *out = fopen(prune_file.c_str(), "w");
+    if (!out)
+    {
+        fprintf(stderr, "Unable to write %s\n", prune_file.c_str());
+        return (-1);
+    }
+    fprintf(out, "# Vault monster specs that failed --validate-vault-specs.\n"
+                 "# des-scanner leaves these out of the vault monster data.\n");
+
+    int invalid = 0;
+    for (unsigned int i = 0; i < specs.size(); ++i)
+    {
+        if (results[i].error.empty())
+            continue;
+
+        printf("Invalid vault spec \"%s\": %s\n", specs[i].c_str(),
+               results[i].error.c_str());
+        fprintf(out, "%s\n", escape_spec_line(specs[i]).c_str());
+        ++invalid;
+    }
+    fclose(out);
+
+    printf("%d of %u vault specs are invalid; written to %s\n", invalid,
+           (unsigned int) specs.size(), prune_file.c_str());
+    return (invalid);
+}
+
+/**
+ * Check that every name compares equal to its own key, as get_vault_monster
+ * relies on, and print any that don't.
+ *
+ * @return How many names didn't.
+**/
+static int check_name_keys (const char *what,
+                            const std::vector<std::string> &names)
+{
+    int mismatches = 0;
+    for (unsigned int i = 0; i < names.size(); ++i)
+    {
+        if (vault_name_compare(names[i].c_str(),
+                               vault_name_key(names[i]).c_str()))
+        {
+            printf("%s: \"%s\" does not compare equal to its key.\n", what,
+                   names[i].c_str());
+            ++mismatches;
+        }
+    }
+    return (mismatches);
+}
+
+/**
+ * Time comparing a name that isn't there with each of a set of names, by
+ * making a key of each name as get_vault_monster used to, and with
+ * vault_name_compare, and print the cost per name of each.
+**/
+static void benchmark_name_set (const char *what,
+                                const std::vector<std::string> &names)
+{
+    if (names.empty())
+    {
+        printf("%s: no names to compare.\n", what);
+        return;
+    }
+
+    const int mismatches = check_name_keys(what, names);
+
+    const std::string query = "Nobody's Such Monster";
+    const std::string query_key = vault_name_key(query);
+    const int rounds = std::max(1, 2000000 / (int) names.size());
+    int matches = 0;
+
+    typedef std::chrono::steady_clock bench_clock;
+    const bench_clock::time_point start = bench_clock::now();
+    for (int r = 0; r < rounds; ++r)
+        for (unsigned int i = 0; i < names.size(); ++i)
+            matches += vault_name_key(names[i]) == query_key;
+    const bench_clock::time_point middle = bench_clock::now();
+    for (int r = 0; r < rounds; ++r)
+        for (unsigned int i = 0; i < names.size(); ++i)
+            matches += !vault_name_compare(names[i].c_str(),
+                                           query_key.c_str());
+    const bench_clock::time_point end = bench_clock::now();
+
+    const double compares = (double) rounds * names.size();
+    printf("%s: %u names, %d rounds%s%s\n", what,
+           (unsigned int) names.size(), rounds,
+           matches ? " (unexpected matches)" : "",
+           mismatches ? " (names that differ from their keys)" : "");
+    printf("  vault_name_key:     %6.1f ns/name\n",
+           std::chrono::duration<double, std::nano>(middle - start).count()
+           / compares);
+    printf("  vault_name_compare: %6.1f ns/name\n",
+           std::chrono::duration<double, std::nano>(end - middle).count()
+           / compares);
+}
+
+/**
+ * Time the name comparisons that get_vault_monster makes: against the names
+ * that vault specs give their monsters, and against the names in the vault
+ * index. The two are reported separately.
+**/
+void benchmark_vault_name_compare ()
+{
+    std::vector<std::string> spec_names;
+    mons_list mons;
+    for (int i = 0, count = vault_monster_count(); i < count; ++i)
+    {
+        mons.clear();
+        if (!mons.add_mons(vault_monster_spec(i), false).empty())
+            continue;
+        const std::string name = vault_spec_name(mons.get_monster(0));
+        if (!name.empty())
+            spec_names.push_back(name);
+    }
+
+    std::vector<std::string> index_names;
+    for (int i = 0, count = vault_index_name_count(); i < count; ++i)
+        index_names.push_back(vault_index_name(i));
+
+    // Names with apostrophes and spaces at their ends, which keys and
+    // comparisons must drop the same way.
+    static const char *edge_names[] =
+    {
+        "' foo", "foo '", " 'Foo' ", "'' foo bar ''", "\t'o'clock'\n", "'",
+    };
+    const std::vector<std::string> edge_cases(edge_names,
+                                              edge_names
+                                              + ARRAYSZ(edge_names));
+    if (!check_name_keys("Edge case names", edge_cases))
+        printf("Edge case names: all compare equal to their keys.\n");
+
+    benchmark_name_set("Vault spec names", spec_names);
+    benchmark_name_set("Vault index names", index_names);
+}
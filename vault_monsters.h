@@ -7,6 +7,32 @@
 
 #include "AppHdr.h"
 
+// What became of a vault monster spec when it was parsed and placed.
+struct vault_spec_result
+{
+    vault_spec_result () : type(MONS_NO_MONSTER) { }
+
+    std::string error;  // Empty if the spec could be used.
+    std::string name;   // The name of the monster it made.
+    int type;           // The monster_type of the monster it made.
+};
+
+std::string vault_name_key (std::string name);
+int vault_name_compare (const char *a, const char *b);
+
+// Orders monster names by their vault_name_key()s.
+struct vault_name_less
+{
+    bool operator() (const std::string &a, const std::string &b) const
+    {
+        return vault_name_compare(a.c_str(), b.c_str()) < 0;
+    }
+};
+
 mons_spec get_vault_monster (std::string monster_name, std::string *vault_spec = 0);
+std::vector<vault_spec_result> check_vault_specs (
+    const std::vector<std::string> &specs, bool place = true);
+int validate_vault_specs (const std::string &prune_file);
+void benchmark_vault_name_compare ();
 
 #endif